@@ -0,0 +1,129 @@
+# Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+#   * Redistributions of source code must retain the above copyright notice,
+#     this list of conditions and the following disclaimer.
+#   * Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#   * Neither the name of ARM Inject nor the names of its contributors may be used
+#     to endorse or promote products derived from this software without
+#     specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+# Decode a binary libhook trace stream ( see jni/libhook/event.h ) back into
+# the same "name( arg=val ... ) -> ret" lines libhook prints to logcat.
+import struct
+import sys
+
+EVENT_MAGIC    = 0x4B4F4F48
+EVENT_STREAM   = 1
+EVENT_FUNCTION = 2
+EVENT_CALL     = 3
+
+class Decoder:
+    def __init__( self ):
+        self.ptrsize   = 4
+        self.version   = 2
+        self.started   = 0
+        self.functions = {}
+
+    def slot( self, fmt, data, off ):
+        if fmt == 'i':
+            return struct.unpack_from( '<i', data, off )[0], off + 4
+        elif fmt == 'u':
+            return struct.unpack_from( '<I', data, off )[0], off + 4
+        elif fmt == 's':
+            size = struct.unpack_from( '<H', data, off )[0]
+            off += 2
+            return '"%s"' % data[off:off + size].decode( 'utf-8', 'replace' ), off + size
+        else:
+            ptr = struct.unpack_from( '<Q' if self.ptrsize == 8 else '<I', data, off )[0]
+            return "0x%x" % ptr, off + self.ptrsize
+
+    def on_stream( self, fnid, data ):
+        magic, self.version, self.ptrsize, _, self.started = struct.unpack_from( '<IBBHQ', data, 0 )
+        if magic != EVENT_MAGIC:
+            raise ValueError( "Invalid stream magic 0x%x." % magic )
+
+    def on_function( self, fnid, data ):
+        strings = data.split( b'\0' )
+        name, fmt = strings[0].decode(), strings[1].decode()
+        argc = fmt.find('.') if '.' in fmt else len(fmt)
+        self.functions[fnid] = ( name, fmt, [ s.decode() for s in strings[2:2 + argc] ] )
+
+    def on_call( self, fnid, data ):
+        if fnid not in self.functions:
+            return None
+
+        name, fmt, names = self.functions[fnid]
+        ts, pid, tid = struct.unpack_from( '<QII', data, 0 )
+        off  = 16
+        args = []
+
+        for i, argname in enumerate(names):
+            value, off = self.slot( fmt[i], data, off )
+            args.append( "%s=%s " % ( argname, value ) )
+
+        # version 1 streams had millisecond timestamps, nanoseconds since then.
+        if self.version < 2:
+            ts *= 1000000
+
+        line = "[ ts=%d.%06d pid=%d, tid=%d ] %s( %s)" % ( ts // 1000000, ts % 1000000, pid, tid, name, ''.join(args) )
+
+        if len(fmt) > len(names) + 1:
+            value, off = self.slot( fmt[len(names) + 1], data, off )
+            line += " -> %s " % value
+
+        return line
+
+    def records( self, data ):
+        off = 0
+        while off + 4 <= len(data):
+            size, type, fnid = struct.unpack_from( '<HBB', data, off )
+            # zeroes past the last record of a segment or an interrupted one.
+            if size < 4:
+                break
+
+            yield type, fnid, data[off + 4:off + size]
+            off += size
+
+    def decode( self, data ):
+        # with concurrent writers a function record can land after the first
+        # call referencing it, so collect them all first.
+        for type, fnid, body in self.records( data ):
+            if type == EVENT_STREAM:
+                self.on_stream( fnid, body )
+            elif type == EVENT_FUNCTION:
+                self.on_function( fnid, body )
+
+        for type, fnid, body in self.records( data ):
+            if type == EVENT_CALL:
+                line = self.on_call( fnid, body )
+                if line is not None:
+                    yield line
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print( "Usage: python %s <trace file or segment> [segment ...]" % sys.argv[0] )
+        quit()
+
+    # every segment is self describing, decode them one by one.
+    for filename in sys.argv[1:]:
+        with open( filename, 'rb' ) as fp:
+            for line in Decoder().decode( fp.read() ):
+                print( line )
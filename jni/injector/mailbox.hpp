@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef MAILBOX_HPP__
+#define MAILBOX_HPP__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+#include "../libhook/mailbox.h"
+
+// milliseconds to wait for the mailbox to be free and then for the answer.
+#define MAILBOX_CLAIM_TIMEOUT 1000
+#define MAILBOX_CALL_TIMEOUT  5000
+// milliseconds between two checks of a mailbox owner which could be dead.
+#define MAILBOX_OWNER_POLL    50
+
+/*
+ * Client side of the libhook mailbox, see libhook/mailbox.h. Once libhook has
+ * been injected, it serves dlopen, dlsym and calls inside the target without
+ * stopping it, so this is tried before attaching with Traced.
+ */
+class Mailbox
+{
+private:
+
+    pid_t       _pid;
+    pid_t       _tid;
+    mailbox_t  *_box;
+    // set by a request that timed out while being served.
+    bool        _timedout;
+    std::string _error;
+
+    static double monotonic() {
+        struct timespec ts = {0, 0};
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+    }
+
+    // wait up to 'timeout' milliseconds while *addr == value.
+    static void wait( volatile int32_t *addr, int32_t value, double timeout ) {
+        struct timespec ts;
+
+        ts.tv_sec  = (time_t)( timeout / 1000 );
+        ts.tv_nsec = (long)( ( timeout - ts.tv_sec * 1000.0 ) * 1000000.0 );
+
+        syscall( __NR_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0 );
+    }
+
+    static void wake( volatile int32_t *addr ) {
+        syscall( __NR_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+    }
+
+    /*
+     * Once owned, the mailbox can still hold a request abandoned by a client
+     * which timed out or left behind by a dead one, wait for the service
+     * thread to be done with it so ours can't be overwritten by its reset.
+     */
+    bool settle( double deadline ) {
+        int32_t state;
+
+        while( ( state = __atomic_load_n( &_box->state, __ATOMIC_ACQUIRE ) ) != MAILBOX_IDLE ){
+            double left = deadline - monotonic();
+
+            // nobody is waiting for this result anymore.
+            if( state == MAILBOX_DONE ){
+                __sync_bool_compare_and_swap( &_box->state, MAILBOX_DONE, MAILBOX_IDLE );
+                continue;
+            }
+            else if( left <= 0 ){
+                release();
+                return false;
+            }
+
+            wait( &_box->state, state, left );
+        }
+
+        return true;
+    }
+
+    /*
+     * Take the mailbox, if its owner died while holding it we take over, in
+     * both cases the request slot must be idle before it's ours.
+     */
+    bool claim( double deadline ) {
+        for(;;){
+            int32_t owner = __atomic_load_n( &_box->owner, __ATOMIC_ACQUIRE );
+            double left = deadline - monotonic();
+
+            if( owner == 0 ){
+                if( __sync_bool_compare_and_swap( &_box->owner, 0, _tid ) ){
+                    return settle( deadline );
+                }
+
+                continue;
+            }
+            else if( kill( owner, 0 ) == -1 && errno == ESRCH && __sync_bool_compare_and_swap( &_box->owner, owner, _tid ) ){
+                return settle( deadline );
+            }
+            else if( left <= 0 ){
+                return false;
+            }
+
+            wait( &_box->owner, owner, std::min( left, (double)MAILBOX_OWNER_POLL ) );
+        }
+    }
+
+    void release() {
+        __atomic_store_n( &_box->owner, 0, __ATOMIC_RELEASE );
+        wake( &_box->owner );
+    }
+
+    unsigned long request( uint32_t op, unsigned long function, const char *data, int nargs, const unsigned long *args, uint32_t strings ) {
+        double deadline = monotonic() + MAILBOX_CLAIM_TIMEOUT;
+        unsigned long result = 0;
+        int32_t state;
+
+        _error.clear();
+        _timedout = false;
+
+        if( _box == NULL ){
+            _error = "not attached";
+            return 0;
+        }
+        else if( ( data && strlen(data) >= MAILBOX_DATA_SIZE ) || nargs > MAILBOX_MAX_ARGS ){
+            _error = "request too big";
+            return 0;
+        }
+        else if( !claim( deadline ) ){
+            _error = "mailbox busy";
+            return 0;
+        }
+
+        _box->op       = op;
+        _box->function = function;
+        _box->nargs    = nargs;
+        _box->strings  = strings;
+
+        for( int i = 0; i < nargs; ++i ){
+            _box->args[i] = args[i];
+        }
+
+        strcpy( _box->data, data ? data : "" );
+
+        __atomic_store_n( &_box->state, MAILBOX_REQUEST, __ATOMIC_RELEASE );
+        wake( &_box->state );
+
+        deadline = monotonic() + MAILBOX_CALL_TIMEOUT;
+
+        while( ( state = __atomic_load_n( &_box->state, __ATOMIC_ACQUIRE ) ) != MAILBOX_DONE ){
+            double left = deadline - monotonic();
+
+            if( left > 0 ){
+                wait( &_box->state, state, left );
+                continue;
+            }
+            // withdraw the request, or leave its result to the service thread,
+            // unless it just got done.
+            else if( !__sync_bool_compare_and_swap( &_box->state, MAILBOX_REQUEST, MAILBOX_IDLE ) &&
+                     !__sync_bool_compare_and_swap( &_box->state, MAILBOX_BUSY, MAILBOX_ABANDONED ) &&
+                     __atomic_load_n( &_box->state, __ATOMIC_ACQUIRE ) == MAILBOX_DONE ){
+                break;
+            }
+            else {
+                fprintf( stderr, "Process %d did not serve the mailbox request in %u ms.\n", _pid, MAILBOX_CALL_TIMEOUT );
+
+                _error = "timeout";
+                _timedout = true;
+                release();
+
+                return 0;
+            }
+        }
+
+        result = (unsigned long)_box->result;
+        if( _box->error ){
+            _box->data[ MAILBOX_DATA_SIZE - 1 ] = '\0';
+            _error = _box->data;
+        }
+
+        __atomic_store_n( &_box->state, MAILBOX_IDLE, __ATOMIC_RELEASE );
+        release();
+
+        return result;
+    }
+
+public:
+
+    Mailbox( pid_t pid ) : _pid(pid), _tid( syscall( __NR_gettid ) ), _box(NULL), _timedout(false) {
+        char filename[0xFF] = {0};
+        struct stat st, proc;
+        void *mem = MAP_FAILED;
+
+        snprintf( filename, sizeof(filename), "/proc/%d", pid );
+        if( stat( filename, &proc ) != 0 ){
+            return;
+        }
+
+        snprintf( filename, sizeof(filename), MAILBOX_PATH, pid );
+
+        int fd = open( filename, O_RDWR | O_NOFOLLOW );
+        if( fd == -1 ){
+            return;
+        }
+
+        // only talk to a private file created by the target itself, anything
+        // else could have been planted to make us call into the wrong process.
+        if( fstat( fd, &st ) == 0 && S_ISREG(st.st_mode) && st.st_uid == proc.st_uid && ( st.st_mode & 077 ) == 0 &&
+            st.st_size >= (off_t)sizeof(mailbox_t) ){
+            mem = mmap( NULL, sizeof(mailbox_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        }
+
+        close( fd );
+
+        if( mem == MAP_FAILED ){
+            return;
+        }
+
+        _box = (mailbox_t *)mem;
+
+        // the file could be left over by a dead process with the same pid.
+        snprintf( filename, sizeof(filename), "/proc/%d/task/%d", pid, _box->tid );
+
+        if( __atomic_load_n( &_box->magic, __ATOMIC_ACQUIRE ) != MAILBOX_MAGIC ||
+            _box->version != MAILBOX_VERSION ||
+            _box->pid != pid ||
+            access( filename, F_OK ) != 0 ){
+            munmap( _box, sizeof(mailbox_t) );
+            _box = NULL;
+        }
+    }
+
+    ~Mailbox() {
+        if( _box ){
+            munmap( _box, sizeof(mailbox_t) );
+        }
+    }
+
+    bool attached() const {
+        return _box != NULL;
+    }
+
+    // the last request was sent but not answered in time, it could still run.
+    bool timedout() const {
+        return _timedout;
+    }
+
+    // error message of the last request, empty if it succeeded.
+    const std::string& error() const {
+        return _error;
+    }
+
+    unsigned long dlopen( const char *libname, int flags = 0 ) {
+        unsigned long args[1] = { (unsigned long)flags };
+
+        return request( MAILBOX_DLOPEN, 0, libname, 1, args, 0 );
+    }
+
+    unsigned long dlsym( unsigned long dl, const char *symname ) {
+        unsigned long args[1] = { dl };
+
+        return request( MAILBOX_DLSYM, 0, symname, 1, args, 0 );
+    }
+
+    // call a function inside the target with up to MAILBOX_MAX_ARGS integers.
+    unsigned long call( void *function, int nargs, ... ) {
+        unsigned long args[MAILBOX_MAX_ARGS] = {0};
+        va_list va;
+
+        if( nargs > MAILBOX_MAX_ARGS ){
+            _error = "too many arguments";
+            return 0;
+        }
+
+        va_start( va, nargs );
+        for( int i = 0; i < nargs; ++i ){
+            args[i] = va_arg( va, unsigned long );
+        }
+        va_end( va );
+
+        return request( MAILBOX_CALL, (unsigned long)function, NULL, nargs, args, 0 );
+    }
+
+    // call a function inside the target with a single string argument, or NULL.
+    unsigned long call( void *function, const char *arg ) {
+        unsigned long args[1] = { 0 };
+
+        return request( MAILBOX_CALL, (unsigned long)function, arg, 1, args, arg ? 1 : 0 );
+    }
+};
+
+#endif
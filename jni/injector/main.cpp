@@ -27,16 +27,501 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include "traced.hpp"
+#include "mailbox.hpp"
 #include <string>
+#include <vector>
+#include <map>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// default control socket of the daemon mode, '@' means abstract namespace.
+#define INJECTOR_SOCKET "/data/local/tmp/injector.sock"
+// only root and adb shell can talk to the daemon.
+#define INJECTOR_SHELL_UID 2000
+#define INJECTOR_SHELL_GID 2000
+// milliseconds a client can stay silent before it's dropped.
+#define INJECTOR_CLIENT_TIMEOUT 5000
+// cached targets before the symbols cache is flushed.
+#define INJECTOR_MAX_CACHED 4096
+
+typedef struct
+{
+    pid_t          pid;
+    // thread to hijack, 0 for the main one.
+    pid_t          tid;
+    bool           injected;
+    unsigned long  handle;
+    // return value of the called symbol, for call requests.
+    unsigned long  result;
+    double         elapsed;
+    // served by the mailbox of an already injected libhook, not stopped.
+    bool           mailbox;
+    traced_symbols_t symbols;
+    traced_times_t stopped;
+}
+job_t;
+
+typedef std::vector<job_t> jobs_t;
+
+// processes are identified by pid and start time, since pids get reused.
+typedef std::pair<pid_t, unsigned long long> process_key_t;
+typedef std::map<process_key_t, traced_symbols_t> symbols_cache_t;
+
+static std::string     __library;
+static const char     *__init = NULL;
+// call __init inside the already loaded __library instead of injecting it.
+static bool            __call = false;
+static jobs_t          __jobs;
+static volatile long   __next = 0;
+// remote symbols resolved by previous requests, only used by the daemon.
+static bool            __cache = false;
+static symbols_cache_t __symbols;
+static pthread_mutex_t __symbols_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int usage( char *argvz ){
-    printf( "Usage: %s <pid> <library>\n", argvz );
+    printf( "Usage: %s <pid[:tid][,pid[:tid]...]|-n name pattern|-u uid> <library> [init symbol]\n", argvz );
+    printf( "       %s -d [socket path, default " INJECTOR_SOCKET "]\n", argvz );
     return 1;
 }
 
+static double now() {
+    struct timeval tv = {0};
+    gettimeofday( &tv, NULL );
+
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void add_job( pid_t pid, pid_t tid = 0 ) {
+    job_t job = { pid, tid, false, 0, 0, 0.0, false, { 0 }, { 0.0, 0.0, 0.0 } };
+    __jobs.push_back( job );
+}
+
+/*
+ * Add a job for every process whose name matches the given shell pattern
+ * or, if pattern is NULL, that belongs to the given uid.
+ */
+static void find_processes( const char *pattern, uid_t uid ) {
+    struct dirent *entry = NULL;
+    pid_t self = getpid();
+
+    DIR *dir = opendir( "/proc" );
+    if( dir == NULL ){
+        perror("opendir");
+        return;
+    }
+
+    while( ( entry = readdir( dir ) ) ) {
+        char filename[0xFF] = {0},
+             cmdline[0xFF] = {0};
+        pid_t pid = atoi( entry->d_name );
+        struct stat st;
+
+        if( pid <= 0 || pid == self ){
+            continue;
+        }
+
+        if( pattern ){
+            sprintf( filename, "/proc/%d/cmdline", pid );
+
+            FILE *fp = fopen( filename, "rt" );
+            if( fp == NULL ){
+                continue;
+            }
+
+            fgets( cmdline, sizeof(cmdline), fp );
+            fclose(fp);
+
+            if( fnmatch( pattern, cmdline, 0 ) == 0 ){
+                add_job( pid );
+            }
+        }
+        else {
+            sprintf( filename, "/proc/%d", pid );
+
+            if( stat( filename, &st ) == 0 && st.st_uid == uid ){
+                add_job( pid );
+            }
+        }
+    }
+
+    closedir( dir );
+}
+
+// add a job for every pid[:tid] of a comma separated list.
+static bool add_pids( char *list ) {
+    char *save = NULL;
+
+    for( char *p = strtok_r( list, ",", &save ); p; p = strtok_r( NULL, ",", &save ) ) {
+        char *tid = strchr( p, ':' );
+        pid_t pid = atoi(p);
+        if( pid == 0 ){
+            fprintf( stderr, "Invaid PID %s\n", p );
+            return false;
+        }
+
+        add_job( pid, tid ? atoi( tid + 1 ) : 0 );
+    }
+
+    return true;
+}
+
+// start time of a process in clock ticks since boot, 0 if it's gone.
+static unsigned long long process_started( pid_t pid ) {
+    char filename[0xFF] = {0},
+         buffer[1024] = {0};
+    unsigned long long started = 0;
+    char *p = NULL;
+
+    sprintf( filename, "/proc/%d/stat", pid );
+
+    FILE *fp = fopen( filename, "rt" );
+    if( fp == NULL ){
+        return 0;
+    }
+
+    // the process name can contain anything, fields start after its ')'.
+    if( fgets( buffer, sizeof(buffer), fp ) && ( p = strrchr( buffer, ')' ) ) ){
+        sscanf( p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &started );
+    }
+
+    fclose(fp);
+
+    return started;
+}
+
+/*
+ * If libhook is already inside the target, its mailbox serves the whole
+ * request without stopping the process, returns false if there's none.
+ */
+static bool inject_mailbox( job_t *job ) {
+    Mailbox box( job->pid );
+    unsigned long sym = 0;
+
+    if( !box.attached() ){
+        return false;
+    }
+
+    job->mailbox = true;
+    job->handle  = box.dlopen( __library.c_str() );
+
+    if( job->handle && __init && ( sym = box.dlsym( job->handle, __init ) ) ){
+        job->result = box.call( (void *)sym, 0 );
+    }
+
+    if( !box.error().empty() ){
+        fprintf( stderr, "[%d] Mailbox request failed: %s\n", job->pid, box.error().c_str() );
+    }
+
+    job->injected = __call ? ( sym != 0 && !box.timedout() ) : ( job->handle != 0 );
+
+    return true;
+}
+
+static void inject( job_t *job ) {
+    double started = now();
+
+    // a specific thread to hijack can only be honoured through ptrace.
+    if( job->tid == 0 && inject_mailbox( job ) ){
+        job->elapsed = now() - started;
+        return;
+    }
+
+    process_key_t key( job->pid, __cache ? process_started( job->pid ) : 0 );
+    traced_symbols_t cached;
+    bool hit = false;
+
+    if( __cache ){
+        pthread_mutex_lock( &__symbols_lock );
+
+        symbols_cache_t::const_iterator i = __symbols.find( key );
+        if( ( hit = ( i != __symbols.end() ) ) ){
+            cached = i->second;
+        }
+
+        pthread_mutex_unlock( &__symbols_lock );
+    }
+
+    // every worker has its own tracer, ptrace requests must come from the
+    // thread that attached.
+    Traced proc( job->pid, job->tid, hit ? &cached : NULL );
+
+    if( proc.attached() ){
+        if( __call ){
+            // dlopen of a loaded library just gives us its handle back.
+            job->handle = proc.dlopen( __library.c_str() );
+            if( job->handle ){
+                unsigned long sym = proc.dlsym( job->handle, __init );
+                if( sym ){
+                    job->result = proc.call( (void *)sym, 0 );
+                }
+                job->injected = ( sym != 0 && !proc.fatal() );
+            }
+        }
+        else {
+            // try with a single stop first, then fall back to the remote calls
+            // chain, unless the stub was interrupted halfway.
+            if( !proc.inject( __library.c_str(), __init, &job->handle ) && !proc.fatal() ){
+                job->handle = proc.dlopen( __library.c_str() );
+                if( job->handle && __init ){
+                    unsigned long sym = proc.dlsym( job->handle, __init );
+                    if( sym ){
+                        proc.call( (void *)sym, 0 );
+                    }
+                }
+            }
+
+            job->injected = ( job->handle != 0 );
+        }
+
+        proc.detach();
+        job->stopped = proc.times();
+        job->symbols = proc.symbols();
+    }
+
+    if( __cache && !hit && job->injected && key.second ){
+        pthread_mutex_lock( &__symbols_lock );
+
+        if( __symbols.size() >= INJECTOR_MAX_CACHED ){
+            __symbols.clear();
+        }
+        __symbols[key] = job->symbols;
+
+        pthread_mutex_unlock( &__symbols_lock );
+    }
+
+    job->elapsed = now() - started;
+}
+
+static void *worker( void * ) {
+    long i;
+
+    while( ( i = __sync_fetch_and_add( &__next, 1 ) ) < (long)__jobs.size() ) {
+        inject( &__jobs[i] );
+    }
+
+    return NULL;
+}
+
+// run every job with a pool of workers, returns how many failed.
+static size_t run_jobs( FILE *out ) {
+    size_t nworkers = std::min( __jobs.size(), (size_t)std::max( 1l, sysconf(_SC_NPROCESSORS_ONLN) ) );
+    std::vector<pthread_t> workers( nworkers );
+    size_t failed = 0;
+
+    fprintf( out, "@ %s %s into %u process(es) with %u worker(s).\n\n", __call ? "Calling symbol of" : "Injecting library", __library.c_str(), (unsigned)__jobs.size(), (unsigned)nworkers );
+
+    double started = now();
+
+    __next = 0;
+
+    for( size_t i = 0; i < nworkers; ++i ){
+        pthread_create( &workers[i], NULL, worker, NULL );
+    }
+
+    for( size_t i = 0; i < nworkers; ++i ){
+        pthread_join( workers[i], NULL );
+    }
+
+    for( jobs_t::const_iterator i = __jobs.begin(), e = __jobs.end(); i != e; ++i ){
+        if( i->injected && __call ){
+            fprintf( out, "@ [%d] %s returned 0x%lX in %.3f ms\n", i->pid, __init, i->result, i->elapsed );
+        }
+        else if( i->injected ){
+            fprintf( out, "@ [%d] dlopen returned 0x%lX in %.3f ms\n", i->pid, i->handle, i->elapsed );
+        }
+        else {
+            fprintf( out, "@ [%d] FAILED after %.3f ms\n", i->pid, i->elapsed );
+            ++failed;
+            continue;
+        }
+
+        if( i->mailbox ){
+            fprintf( out, "  served by the libhook mailbox, nothing stopped\n" );
+            continue;
+        }
+
+        fprintf( out, "  thread %d stopped for %.3f ms ( attach %.3f ms, remote code %.3f ms, tracer %.3f ms )\n",
+                 i->tid ? i->tid : i->pid, i->stopped.total, i->stopped.attach, i->stopped.remote,
+                 i->stopped.total - i->stopped.attach - i->stopped.remote );
+    }
+
+    fprintf( out, "\n@ Done in %.3f ms, %u succeeded, %u failed.\n", now() - started, (unsigned)( __jobs.size() - failed ), (unsigned)failed );
+
+    return failed;
+}
+
+/*
+ * Handle a daemon request, one per line:
+ *
+ *   inject <pid[:tid][,...]|name:pattern|uid:uid> <library> [init symbol]
+ *   call <pid[:tid][,...]|name:pattern|uid:uid> <library> <symbol>
+ *   ping
+ *
+ * the reply is the same output of a command line run, ended by an "OK" or
+ * "ERR" line.
+ */
+static void handle_request( char *line, FILE *out ) {
+    char *save = NULL,
+         *cmd = strtok_r( line, " \t\r\n", &save ),
+         *targets = strtok_r( NULL, " \t\r\n", &save ),
+         *library = strtok_r( NULL, " \t\r\n", &save ),
+         *init = strtok_r( NULL, " \t\r\n", &save );
+
+    __jobs.clear();
+
+    if( cmd == NULL ){
+        return;
+    }
+    else if( strcmp( cmd, "ping" ) == 0 ){
+        fprintf( out, "OK\n" );
+        return;
+    }
+    else if( ( strcmp( cmd, "inject" ) != 0 && strcmp( cmd, "call" ) != 0 ) || !targets || !library || ( cmd[0] == 'c' && !init ) ){
+        fprintf( out, "ERR Invalid request.\n" );
+        return;
+    }
+
+    if( strncmp( targets, "name:", 5 ) == 0 ){
+        find_processes( targets + 5, 0 );
+    }
+    else if( strncmp( targets, "uid:", 4 ) == 0 ){
+        find_processes( NULL, atoi( targets + 4 ) );
+    }
+    else if( !add_pids( targets ) ){
+        fprintf( out, "ERR Invalid PID list.\n" );
+        return;
+    }
+
+    if( __jobs.empty() ){
+        fprintf( out, "ERR No matching processes.\n" );
+        return;
+    }
+
+    __library = library;
+    __init    = init;
+    __call    = ( cmd[0] == 'c' );
+
+    size_t failed = run_jobs( out );
+
+    fprintf( out, "%s\n", failed ? "ERR" : "OK" );
+}
+
+/*
+ * Serve requests on a unix socket, keeping the local maps and the symbols
+ * resolved for every target across requests, so re-injecting into a process
+ * or injecting into a burst of new ones skips all the startup work.
+ */
+static int daemon_main( const char *path ) {
+    struct sockaddr_un addr;
+    socklen_t addrlen = 0;
+    int srv = -1;
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+
+    if( strlen(path) >= sizeof(addr.sun_path) ){
+        fprintf( stderr, "Socket path too long.\n" );
+        return 1;
+    }
+    // abstract namespace, no file to clean up but no permissions either, the
+    // peer credentials are what protects it.
+    else if( path[0] == '@' ){
+        strcpy( addr.sun_path + 1, path + 1 );
+        addrlen = offsetof( struct sockaddr_un, sun_path ) + strlen(path);
+    }
+    else {
+        strcpy( addr.sun_path, path );
+        addrlen = sizeof(addr);
+        unlink( path );
+    }
+
+    // the socket file is created 0600 and only then opened to the shell
+    // group, so nobody else can ever connect to it.
+    mode_t mask = umask( 0077 );
+
+    if( ( srv = socket( AF_UNIX, SOCK_STREAM, 0 ) ) == -1 ||
+        bind( srv, (struct sockaddr *)&addr, addrlen ) == -1 ){
+        perror("socket");
+        return 1;
+    }
+
+    umask( mask );
+
+    if( path[0] != '@' && ( chown( path, 0, INJECTOR_SHELL_GID ) == -1 || chmod( path, 0660 ) == -1 ) ){
+        perror("chmod");
+        return 1;
+    }
+    else if( listen( srv, 8 ) == -1 ){
+        perror("listen");
+        return 1;
+    }
+
+    signal( SIGPIPE, SIG_IGN );
+
+    __cache = true;
+
+    printf( "@ Listening on %s ...\n", path );
+
+    for(;;){
+        char line[1024] = {0};
+        struct timeval timeout = { INJECTOR_CLIENT_TIMEOUT / 1000, ( INJECTOR_CLIENT_TIMEOUT % 1000 ) * 1000 };
+        struct ucred cred;
+        socklen_t credlen = sizeof(cred);
+
+        int client = accept( srv, NULL, NULL );
+        if( client == -1 ){
+            continue;
+        }
+
+        cred.uid = (uid_t)-1;
+
+        // anybody else could run code as root in any process through us.
+        if( getsockopt( client, SOL_SOCKET, SO_PEERCRED, &cred, &credlen ) == -1 ||
+            ( cred.uid != 0 && cred.uid != INJECTOR_SHELL_UID ) ){
+            fprintf( stderr, "@ Refused client with uid %d.\n", (int)cred.uid );
+            close( client );
+            continue;
+        }
+
+        // requests are served one client at a time, a silent one must not
+        // hang the daemon.
+        setsockopt( client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+        setsockopt( client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout) );
+
+        FILE *in  = fdopen( client, "r" ),
+             *out = fdopen( dup(client), "w" );
+
+        if( in && out ){
+            while( fgets( line, sizeof(line), in ) ){
+                handle_request( line, out );
+                fflush( out );
+            }
+        }
+
+        if( in ){
+            fclose( in );
+        }
+        else {
+            close( client );
+        }
+
+        if( out ){
+            fclose( out );
+        }
+    }
+
+    return 0;
+}
+
 int main( int argc, char **argv )
 {
-    if( argc < 3 ){
+    if( argc < 2 ){
         return usage(argv[0]);
     }
     else if( geteuid() != 0 ){
@@ -44,23 +529,43 @@ int main( int argc, char **argv )
         return 1;
     }
 
-    pid_t       pid     = atoi(argv[1]);
-    std::string library = argv[2];
+    int arg = 1;
 
-    if( pid == 0 ){
-        fprintf( stderr, "Invaid PID %s\n", argv[1] );
-        return 1;
+    if( strcmp( argv[arg], "-d" ) == 0 ){
+        return daemon_main( argc > 2 ? argv[2] : INJECTOR_SOCKET );
     }
+    else if( argc < 3 ){
+        return usage(argv[0]);
+    }
+    else if( strcmp( argv[arg], "-n" ) == 0 || strcmp( argv[arg], "-u" ) == 0 ){
+        if( argc < 4 ){
+            return usage(argv[0]);
+        }
 
-    Traced proc(pid);
+        if( argv[arg][1] == 'n' ){
+            find_processes( argv[arg + 1], 0 );
+        }
+        else {
+            find_processes( NULL, atoi(argv[arg + 1]) );
+        }
 
-    printf( "@ Injecting library %s into process %d.\n\n", library.c_str(), pid );
+        arg += 2;
+    }
+    else {
+        if( !add_pids( argv[arg] ) ){
+            return 1;
+        }
 
-    printf( "@ Calling dlopen in target process ...\n" );
+        arg += 1;
+    }
 
-    unsigned long dlret = proc.dlopen( library.c_str() );
+    __library = argv[arg];
+    __init    = argc > arg + 1 ? argv[arg + 1] : NULL;
 
-    printf( "@ dlopen returned 0x%lX\n", dlret );
+    if( __jobs.empty() ){
+        fprintf( stderr, "No matching processes.\n" );
+        return 1;
+    }
 
-    return 0;
+    return run_jobs( stdout ) ? 1 : 0;
 }
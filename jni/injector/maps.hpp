@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef MAPS_H__
+#define MAPS_H__
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+typedef struct
+{
+    uintptr_t start;
+    uintptr_t end;
+    int       prot;
+    bool      priv;
+    // index inside the paths table, -1 for anonymous mappings.
+    int       path;
+}
+mapping_t;
+
+/*
+ * A parsed snapshot of /proc/<pid>/maps, taken once and then queried as many
+ * times as needed without going through the file again.
+ */
+class Maps
+{
+private:
+
+    std::vector<mapping_t>   _mappings;
+    std::vector<std::string> _paths;
+    // lowest address each path is mapped at.
+    std::vector<uintptr_t>   _bases;
+    // path -> index inside _paths and _bases.
+    std::map<std::string, int> _index;
+
+public:
+
+    Maps() {
+
+    }
+
+    bool load( pid_t pid ) {
+        char filename[0xFF] = {0},
+             buffer[1024] = {0},
+             perms[5] = {0};
+        FILE *fp = NULL;
+        mapping_t m;
+        int offset = 0;
+
+        _mappings.clear();
+        _paths.clear();
+        _bases.clear();
+        _index.clear();
+
+        sprintf( filename, "/proc/%d/maps", pid );
+
+        if( ( fp = fopen( filename, "rt" ) ) == NULL ){
+            perror("fopen");
+            return false;
+        }
+
+        while( fgets( buffer, sizeof(buffer), fp ) ) {
+            if( sscanf( buffer, "%lx-%lx %4s %*x %*s %*u %n", (unsigned long *)&m.start, (unsigned long *)&m.end, perms, &offset ) < 3 ){
+                continue;
+            }
+
+            m.prot = ( perms[0] == 'r' ? PROT_READ : 0 ) |
+                     ( perms[1] == 'w' ? PROT_WRITE : 0 ) |
+                     ( perms[2] == 'x' ? PROT_EXEC : 0 );
+            m.priv = perms[3] == 'p';
+            m.path = -1;
+
+            char *path = buffer + offset;
+            path[ strcspn( path, "\n" ) ] = 0;
+
+            if( offset && *path ){
+                std::map<std::string, int>::iterator i = _index.find( path );
+
+                // maps are sorted, so the first mapping of a path is its base.
+                if( i == _index.end() ){
+                    m.path = _index[path] = _paths.size();
+                    _paths.push_back( path );
+                    _bases.push_back( m.start );
+                }
+                else {
+                    m.path = i->second;
+                }
+            }
+
+            _mappings.push_back( m );
+            offset = 0;
+        }
+
+        fclose(fp);
+
+        return true;
+    }
+
+    /*
+     * Base address of a library, looked up by its full path and then, like
+     * the older strstr based scan, by any path containing the given name.
+     */
+    uintptr_t base( const char *library ) const {
+        std::map<std::string, int>::const_iterator i = _index.find( library );
+
+        if( i != _index.end() ){
+            return _bases[i->second];
+        }
+
+        for( size_t j = 0; j < _paths.size(); ++j ){
+            if( strstr( _paths[j].c_str(), library ) ){
+                return _bases[j];
+            }
+        }
+
+        return 0;
+    }
+
+    const std::vector<mapping_t>& mappings() const {
+        return _mappings;
+    }
+
+    const char *path( const mapping_t& m ) const {
+        return m.path == -1 ? "" : _paths[m.path].c_str();
+    }
+};
+
+#endif
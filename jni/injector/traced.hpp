@@ -41,24 +41,243 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <elf.h>
+#include <algorithm>
+#include <string>
+#include "maps.hpp"
 
 #define CPSR_T_MASK ( 1u << 5 )
+// size of the remote scratch region strings are allocated from.
+#define TRACED_ARENA_SIZE 16384
+// milliseconds to wait for the target to stop after attaching and for a
+// remote call to return.
+#define TRACED_STOP_TIMEOUT 1000
+#define TRACED_CALL_TIMEOUT 5000
+// remote calls return to this unmapped address, the fault stops the thread
+// and tells us it's done without touching any code other threads could run.
+#define TRACED_RETURN       0
+// microseconds between two checks of a stopping thread, doubled up to the max.
+#define TRACED_POLL_MIN     20
+#define TRACED_POLL_MAX     1000
+
+// missing from older headers.
+#ifndef PTRACE_SEIZE
+#   define PTRACE_SEIZE      0x4206
+#endif
+#ifndef PTRACE_INTERRUPT
+#   define PTRACE_INTERRUPT  0x4207
+#endif
+#ifndef PTRACE_EVENT_STOP
+#   define PTRACE_EVENT_STOP 128
+#endif
+
+// remote addresses of the functions Traced needs, see Traced::symbols().
+typedef struct
+{
+    void *dlopen;
+    void *dlsym;
+    void *dlerror;
+    void *calloc;
+    void *free;
+    void *mmap;
+    void *munmap;
+}
+traced_symbols_t;
+
+// how long the traced thread was held, in milliseconds.
+typedef struct
+{
+    // from the attach request to the thread being stopped.
+    double attach;
+    // running remote code, between a continue and its return.
+    double remote;
+    // from the attach request to the detach.
+    double total;
+}
+traced_times_t;
 
 class Traced
 {
 private:
 
     pid_t _pid;
+    // the thread being traced, the main one unless otherwise specified.
+    pid_t _tid;
+    // /proc/<pid>/mem descriptor, opened on demand.
+    int   _mem;
+    bool  _attached;
+    // attached with PTRACE_SEIZE, so only _tid is ever stopped.
+    bool  _seized;
+
+    // a remote call timed out and the thread was interrupted in the middle
+    // of it, no more remote code can be run safely.
+    bool  _fatal;
+
+    traced_times_t _times;
+    double         _started;
 
     void *_dlopen;
     void *_dlsym;
     void *_dlerror;
     void *_calloc;
     void *_free;
+    void *_mmap;
+    void *_munmap;
+
+    // remote scratch region, mapped the first time it's needed.
+    unsigned long _arena;
+    size_t        _arenaUsed;
+    // false if the region came from calloc because mmap failed.
+    bool          _arenaMapped;
+
+    // snapshot of the target maps, taken once at attach time.
+    Maps  _maps;
+
+    static Maps& localMapsStorage() {
+        static Maps maps;
+        return maps;
+    }
+
+    static void loadLocalMaps() {
+        localMapsStorage().load( getpid() );
+    }
+
+    // the injector maps never change, they're parsed once for all targets.
+    static const Maps& localMaps() {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+        pthread_once( &once, loadLocalMaps );
+
+        return localMapsStorage();
+    }
+
+    static double monotonic() {
+        struct timespec ts = {0, 0};
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+    }
+
+    /*
+     * Wait up to 'timeout' milliseconds for the traced thread to stop, polling
+     * so that a target which never gets there can't hang the injector.
+     */
+    bool waitStop( int *status, unsigned timeout ) {
+        double deadline = monotonic() + timeout;
+        useconds_t poll = TRACED_POLL_MIN;
+        pid_t ret;
+
+        do {
+            if( ( ret = waitpid( _tid, status, __WALL | WNOHANG ) ) == _tid ){
+                return WIFSTOPPED(*status);
+            }
+            else if( ret == -1 ){
+                perror("waitpid");
+                return false;
+            }
+
+            // short calls are noticed right away, long ones don't keep us
+            // spinning.
+            usleep( poll );
+            poll = std::min( poll * 2, (useconds_t)TRACED_POLL_MAX );
+        }
+        while( monotonic() < deadline );
+
+        return false;
+    }
+
+    /*
+     * Stop the traced thread wherever it is: seized threads are interrupted,
+     * attached ones can only be sent a SIGSTOP. Signals arriving before our
+     * own stop are passed on, so nothing the target expects gets lost.
+     */
+    bool interrupt( int *status ) {
+        double deadline = monotonic() + TRACED_STOP_TIMEOUT;
+
+        if( _seized ? trace( PTRACE_INTERRUPT ) == -1 : syscall( __NR_tgkill, _pid, _tid, SIGSTOP ) == -1 ){
+            perror("interrupt");
+            return false;
+        }
+
+        for(;;){
+            double left = deadline - monotonic();
+
+            if( left <= 0 || !waitStop( status, (unsigned)left ) ){
+                return false;
+            }
+            else if( _seized ? ( *status >> 16 ) == PTRACE_EVENT_STOP : WSTOPSIG(*status) == SIGSTOP ){
+                return true;
+            }
+
+            trace( PTRACE_CONT, 0, ( *status >> 16 ) == 0 ? WSTOPSIG(*status) : 0 );
+        }
+    }
+
+    /*
+     * Resume the traced thread and wait for it to hit a breakpoint or to fault
+     * on TRACED_RETURN, signals it receives meanwhile are passed on, the fault
+     * is not. On timeout the thread is stopped with interrupt(), in the middle
+     * of the remote code: that's fatal.
+     */
+    bool runToTrap( unsigned timeout ) {
+        double started = monotonic(),
+               deadline = started + timeout;
+        int status = 0, signo = 0;
+        bool trapped = false;
+
+        while( !trapped ){
+            double left = deadline - monotonic();
+
+            trace( PTRACE_CONT, 0, signo );
+            signo = 0;
+
+            if( left <= 0 || !waitStop( &status, (unsigned)left ) ){
+                fprintf( stderr, "FATAL: thread %d did not return from remote code in %u ms, "
+                                 "no more remote calls will be made.\n", _tid, timeout );
+
+                if( !interrupt( &status ) ){
+                    fprintf( stderr, "FATAL: thread %d could not be stopped and keeps running the remote code.\n", _tid );
+                }
+
+                _fatal = true;
+                break;
+            }
+            else if( WSTOPSIG(status) == SIGTRAP && ( status >> 16 ) == 0 ){
+                trapped = true;
+            }
+            else if( WSTOPSIG(status) == SIGSEGV && ( status >> 16 ) == 0 ){
+                struct pt_regs regs = {{0}};
+
+                trace( PTRACE_GETREGS, 0, (size_t)&regs );
+
+                // a remote call returned, anything else is a real crash.
+                if( (unsigned long)regs.ARM_pc == TRACED_RETURN ){
+                    trapped = true;
+                }
+                else {
+                    signo = SIGSEGV;
+                }
+            }
+            // anything but a group stop or an interrupt is a signal to deliver.
+            else if( ( status >> 16 ) == 0 ){
+                signo = WSTOPSIG(status);
+            }
+        }
+
+        _times.remote += monotonic() - started;
+
+        return trapped;
+    }
 
     // ptrace wrapper with some error checking.
     long trace( int request, void *addr = 0, size_t data = 0 ) {
-        long ret = ptrace( request, _pid, (caddr_t)addr, (void *)data );
+        long ret = ptrace( request, _tid, (caddr_t)addr, (void *)data );
         if( ret == -1 && (errno == EBUSY || errno == EFAULT || errno == ESRCH) ){
             perror("ptrace");
             return -1;
@@ -69,50 +288,69 @@ private:
 public:
 
     /*
-     * This method will open /proc/<pid>/maps and search for the specified
-     * library base address.
+     * Base address of the specified library, either inside the target or
+     * inside the injector itself, looked up in the parsed maps snapshots.
      */
     uintptr_t findLibrary( const char *library, pid_t pid = -1 ) {
-        char filename[0xFF] = {0},
-             buffer[1024] = {0};
-        FILE *fp = NULL;
-        uintptr_t address = 0;
+        return ( pid == getpid() ? localMaps() : _maps ).base( library );
+    }
 
-        sprintf( filename, "/proc/%d/maps", pid == -1 ? _pid : pid );
+    /*
+     * Compute the delta of the local and the remote modules and apply it to
+     * the local address of the symbol ... BOOM, remote symbol address!
+     */
+    void *findFunction( const char* library, void* local_addr ){
+        uintptr_t local_handle, remote_handle;
 
-        fp = fopen( filename, "rt" );
-        if( fp == NULL ){
-            perror("fopen");
-            goto done;
-        }
+        local_handle = localMaps().base( library );
+        remote_handle = _maps.base( library );
 
-        while( fgets( buffer, sizeof(buffer), fp ) ) {
-            if( strstr( buffer, library ) ){
-                address = (uintptr_t)strtoul( buffer, NULL, 16 );
-                goto done;
-            }
+        if( !local_handle || !remote_handle ){
+            return NULL;
         }
 
-        done:
+        return (void *)( (uintptr_t)local_addr + (uintptr_t)remote_handle - (uintptr_t)local_handle );
+    }
 
-        if(fp){
-            fclose(fp);
-        }
+    const Maps& maps() const {
+        return _maps;
+    }
 
-        return address;
+    /*
+     * Transfer 'blen' bytes with a single process_vm_readv/writev call, this
+     * won't work on mappings the target itself can't write to.
+     */
+    bool vmTransfer( size_t addr, unsigned char *buf, size_t blen, bool write ){
+#if defined(__NR_process_vm_readv) && defined(__NR_process_vm_writev)
+        struct iovec local  = { buf, blen },
+                     remote = { (void *)addr, blen };
+
+        return syscall( write ? __NR_process_vm_writev : __NR_process_vm_readv, _pid, &local, 1, &remote, 1, 0 ) == (long)blen;
+#else
+        return false;
+#endif
     }
 
     /*
-     * Compute the delta of the local and the remote modules and apply it to
-     * the local address of the symbol ... BOOM, remote symbol address!
+     * Transfer 'blen' bytes through /proc/<pid>/mem, which ignores the page
+     * protection of the target just like ptrace does.
      */
-    void *findFunction( const char* library, void* local_addr ){
-        uintptr_t local_handle, remote_handle;
+    bool memTransfer( size_t addr, unsigned char *buf, size_t blen, bool write ){
+        if( _mem == -1 ){
+            char filename[0xFF] = {0};
 
-        local_handle = findLibrary( library, getpid() );
-        remote_handle = findLibrary( library );
+            sprintf( filename, "/proc/%d/mem", _pid );
+            if( ( _mem = open( filename, O_RDWR ) ) == -1 ){
+                return false;
+            }
+        }
 
-        return (void *)( (uintptr_t)local_addr + (uintptr_t)remote_handle - (uintptr_t)local_handle );
+        if( write ){
+            return pwrite64( _mem, buf, blen, (off64_t)addr ) == (ssize_t)blen;
+        }
+        else {
+            return pread64( _mem, buf, blen, (off64_t)addr ) == (ssize_t)blen;
+        }
     }
 
     /*
@@ -122,13 +360,19 @@ public:
         size_t i = 0;
         long ret = 0;
 
-        for( i = 0; i < blen; i += sizeof(size_t) ){
+        if( vmTransfer( addr, buf, blen, false ) || memTransfer( addr, buf, blen, false ) ){
+            return true;
+        }
+
+        // last resort, one word at a time.
+        for( i = 0; i < blen; i += sizeof(long) ){
+            errno = 0;
             ret = trace( PTRACE_PEEKTEXT, (void *)(addr + i) );
-            if( ret == -1 ) {
+            if( ret == -1 && errno != 0 ) {
                 return false;
             }
 
-            memcpy( &buf[i], &ret, sizeof(ret) );
+            memcpy( &buf[i], &ret, std::min( sizeof(ret), blen - i ) );
         }
 
         return true;
@@ -139,21 +383,27 @@ public:
      */
     bool write( size_t addr, unsigned char *buf, size_t blen){
         size_t i = 0;
-        long ret;
+        long word = 0;
 
-        // make sure the buffer is word aligned
-        char *ptr = (char *)calloc(blen + blen % sizeof(size_t), 1);
-        memcpy(ptr, buf, blen);
+        if( vmTransfer( addr, buf, blen, true ) || memTransfer( addr, buf, blen, true ) ){
+            return true;
+        }
 
-        for( i = 0; i < blen; i += sizeof(size_t) ){
-            ret = trace( PTRACE_POKETEXT, (void *)(addr + i), *(size_t *)&ptr[i] );
-            if( ret == -1 ) {
-                ::free(ptr);
+        // last resort, one word at a time.
+        for( i = 0; i < blen; i += sizeof(long) ){
+            size_t chunk = std::min( sizeof(long), blen - i );
+
+            // preserve the remote bytes past the end of the buffer.
+            if( chunk < sizeof(long) && !read( addr + i, (unsigned char *)&word, sizeof(long) ) ){
                 return false;
             }
-        }
 
-        ::free(ptr);
+            memcpy( &word, &buf[i], chunk );
+
+            if( trace( PTRACE_POKETEXT, (void *)(addr + i), (size_t)word ) == -1 ) {
+                return false;
+            }
+        }
 
         return true;
     }
@@ -166,6 +416,10 @@ public:
         int i = 0;
         struct pt_regs regs = {{0}}, rbackup = {{0}};
 
+        if( _fatal ){
+            return 0;
+        }
+
         // get registers and backup them
         trace( PTRACE_GETREGS, 0, (size_t)&regs );
         memcpy( &rbackup, &regs, sizeof(struct pt_regs) );
@@ -173,6 +427,12 @@ public:
         va_list vl;
         va_start(vl,nargs);
 
+        // room for the arguments past the fourth, the fifth one must end up at
+        // the new stack pointer, which stays 8 bytes aligned.
+        if( nargs > 4 ){
+            regs.ARM_sp = ( regs.ARM_sp - ( nargs - 4 ) * sizeof(long) ) & ~7ul;
+        }
+
         for( i = 0; i < nargs; ++i ){
             unsigned long arg = va_arg( vl, long );
 
@@ -180,16 +440,16 @@ public:
             if( i < 4 ){
                 regs.uregs[i] = arg;
             }
-            // push remaining params onto stack
+            // and the remaining ones on the stack, in order.
             else {
-                regs.ARM_sp -= sizeof(long) ;
-                write( (size_t)regs.ARM_sp, (uint8_t *)&arg, sizeof(long) );
+                write( (size_t)regs.ARM_sp + ( i - 4 ) * sizeof(long), (uint8_t *)&arg, sizeof(long) );
             }
         }
 
         va_end(vl);
 
-        regs.ARM_lr = 0;
+        // return to an address which faults, in ARM mode.
+        regs.ARM_lr = TRACED_RETURN;
         regs.ARM_pc = (long int)function;
         // setup the current processor status register
         if ( regs.ARM_pc & 1 ){
@@ -204,11 +464,14 @@ public:
 
         // do the call
         trace( PTRACE_SETREGS, 0, (size_t)&regs );
-        trace( PTRACE_CONT );
-        waitpid( _pid, NULL, WUNTRACED );
 
         // get registers again, R0 holds the return value
-        trace( PTRACE_GETREGS, 0, (size_t)&regs );
+        if( runToTrap( TRACED_CALL_TIMEOUT ) ){
+            trace( PTRACE_GETREGS, 0, (size_t)&regs );
+        }
+        else {
+            regs.ARM_r0 = 0;
+        }
 
         // restore original registers state
         trace( PTRACE_SETREGS, 0, (size_t)&rbackup );
@@ -216,31 +479,188 @@ public:
         return regs.ARM_r0;
     }
 
-    // Copy a given string into the remote process memory.
+    /*
+     * Search the given entry type inside the remote auxiliary vector.
+     */
+    unsigned long findAuxv( unsigned long type ) {
+        char filename[0xFF] = {0};
+        unsigned long entry[2] = {0};
+        unsigned long value = 0;
+        int fd = -1;
+
+        sprintf( filename, "/proc/%d/auxv", _pid );
+
+        fd = open( filename, O_RDONLY );
+        if( fd == -1 ){
+            perror("open");
+            return 0;
+        }
+
+        while( ::read( fd, entry, sizeof(entry) ) == sizeof(entry) && entry[0] != AT_NULL ){
+            if( entry[0] == type ){
+                value = entry[1];
+                break;
+            }
+        }
+
+        close(fd);
+
+        return value;
+    }
+
+    /*
+     * Load a library and optionally call one of its symbols with a single stop
+     * of the target. A small ARM stub is written over the entry point of the
+     * executable ( which is never executed again ) and the strings below the
+     * stack pointer, the stub then does:
+     *
+     *   handle = dlopen( libname, RTLD_NOW );
+     *   if( init && handle && ( fn = dlsym( handle, init ) ) ) fn();
+     *   return handle;
+     *
+     * and hits a breakpoint, after which the original code and registers are
+     * restored. Returns false if the stub could not run, in which case the
+     * caller can still fall back to dlopen().
+     */
+    bool inject( const char *libname, const char *init, unsigned long *handle ) {
+        static const uint32_t stub[] = {
+            0xE12FFF34, //       blx   r4           ; dlopen( r0, r1 )
+            0xE1A07000, //       mov   r7, r0
+            0xE3560000, //       cmp   r6, #0
+            0x13500000, //       cmpne r0, #0
+            0x0A000003, //       beq   done
+            0xE1A01006, //       mov   r1, r6
+            0xE12FFF35, //       blx   r5           ; dlsym( handle, init )
+            0xE3500000, //       cmp   r0, #0
+            0x112FFF30, //       blxne r0           ; init()
+            0xE1A00007, // done: mov   r0, r7
+            0xE1200070  //       bkpt  #0
+        };
+        unsigned char backup[sizeof(stub)] = {0};
+        struct pt_regs regs = {{0}}, rbackup = {{0}};
+        size_t liblen  = strlen(libname) + 1,
+               initlen = init ? strlen(init) + 1 : 0;
+        unsigned long entry = findAuxv( AT_ENTRY ),
+                      code  = ( entry + 3 ) & ~3ul,
+                      data  = 0;
+        bool done = false;
+
+        if( _fatal || entry == 0 || !read( code, backup, sizeof(backup) ) ){
+            return false;
+        }
+
+        trace( PTRACE_GETREGS, 0, (size_t)&regs );
+        memcpy( &rbackup, &regs, sizeof(struct pt_regs) );
+
+        // strings go below the current stack pointer, leaving some room and
+        // keeping the new one 8 bytes aligned as the AAPCS requires.
+        data = ( regs.ARM_sp - 128 - liblen - initlen ) & ~7ul;
+
+        std::string strings( libname, liblen );
+        if( init ){
+            strings.append( init, initlen );
+        }
+
+        if( !write( data, (unsigned char *)strings.data(), strings.size() ) ||
+            !write( code, (unsigned char *)stub, sizeof(stub) ) ){
+            return false;
+        }
+
+        regs.uregs[0] = data;
+        regs.uregs[1] = RTLD_NOW;
+        regs.uregs[4] = (unsigned long)_dlopen;
+        regs.uregs[5] = (unsigned long)_dlsym;
+        regs.uregs[6] = init ? data + liblen : 0;
+        regs.ARM_sp   = data;
+        regs.ARM_pc   = code;
+        regs.ARM_cpsr &= ~CPSR_T_MASK;
+
+        trace( PTRACE_SETREGS, 0, (size_t)&regs );
+
+        if( runToTrap( TRACED_CALL_TIMEOUT ) ){
+            trace( PTRACE_GETREGS, 0, (size_t)&regs );
+            *handle = regs.ARM_r0;
+            done = true;
+        }
+        else {
+            fprintf( stderr, "Injection stub did not complete.\n" );
+        }
+
+        // put everything back.
+        write( code, backup, sizeof(backup) );
+        trace( PTRACE_SETREGS, 0, (size_t)&rbackup );
+
+        return done;
+    }
+
+    /*
+     * Allocate from the remote scratch region, which costs one remote mmap
+     * call the first time and nothing afterwards. Allocations are released
+     * all together by rewinding to a previous arenaMark().
+     */
+    unsigned long alloc( size_t size ) {
+        size = ( size + 7 ) & ~7ul;
+
+        if( _arena == 0 ){
+            if( _mmap && _munmap ){
+                _arena = call( _mmap, 6, 0, TRACED_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+                _arenaMapped = true;
+            }
+
+            if( _arena == (unsigned long)MAP_FAILED || _arena == 0 ){
+                _arena = call( _calloc, 2, TRACED_ARENA_SIZE, 1 );
+                _arenaMapped = false;
+            }
+
+            _arenaUsed = 0;
+        }
+
+        if( _arena == 0 || _arenaUsed + size > TRACED_ARENA_SIZE ){
+            return 0;
+        }
+
+        _arenaUsed += size;
+
+        return _arena + _arenaUsed - size;
+    }
+
+    size_t arenaMark() const {
+        return _arenaUsed;
+    }
+
+    void arenaRewind( size_t mark ) {
+        _arenaUsed = mark;
+    }
+
+    // Copy a given string into the remote scratch region.
     unsigned long copyString( const char *s ) {
-        unsigned long mem = call( _calloc, 2, strlen(s) + 1, 1 );
+        unsigned long mem = alloc( strlen(s) + 1 );
 
-        write( mem, (unsigned char *)s, strlen(s) + 1 );
+        if( mem && !write( mem, (unsigned char *)s, strlen(s) + 1 ) ){
+            mem = 0;
+        }
 
         return mem;
     }
 
     // Remotely force the target process to dlopen a library.
     unsigned long dlopen( const char *libname ) {
-        unsigned long pmem = copyString(libname);
-        unsigned long plib = call( _dlopen, 2, pmem, 0 );
+        size_t mark = arenaMark();
+        unsigned long pmem = copyString(libname),
+                      plib = pmem ? call( _dlopen, 2, pmem, 0 ) : 0;
 
-        free(pmem);
+        arenaRewind(mark);
 
         return plib;
     }
 
     // Remotely call dlsym on the target process.
     unsigned long dlsym( unsigned long dl, const char *symname ) {
-        unsigned long pmem = copyString(symname);
-        unsigned long psym = call( _dlsym, 2, dl, pmem );
+        size_t mark = arenaMark();
+        unsigned long pmem = copyString(symname),
+                      psym = pmem ? call( _dlsym, 2, dl, pmem ) : 0;
 
-        free(pmem);
+        arenaRewind(mark);
 
         return psym;
     }
@@ -250,44 +670,138 @@ public:
         call( _free, 1, p );
     }
 
-    Traced( pid_t pid ) : _pid(pid) {
-        if( trace( PTRACE_ATTACH ) != -1 ){
-            int status;
-            waitpid( _pid, &status, 0 );
-
+    /*
+     * Attach to the given thread of a process, the main one by default. With
+     * PTRACE_SEIZE + PTRACE_INTERRUPT only that thread is stopped, while the
+     * PTRACE_ATTACH fallback for older kernels stops the whole process.
+     * Symbols previously resolved for the same process can be passed to skip
+     * reading its maps altogether.
+     */
+    Traced( pid_t pid, pid_t tid = 0, const traced_symbols_t *cached = NULL ) : _pid(pid), _tid(tid ? tid : pid), _mem(-1), _attached(false), _seized(false),
+                                         _fatal(false), _started(0), _dlopen(NULL), _dlsym(NULL), _dlerror(NULL),
+                                         _calloc(NULL), _free(NULL), _mmap(NULL), _munmap(NULL), _arena(0), _arenaUsed(0), _arenaMapped(false) {
+        int status = 0;
+
+        memset( &_times, 0, sizeof(_times) );
+
+        // nothing here needs the target stopped, so it's done before attaching.
+        if( cached ){
+            _dlopen  = cached->dlopen;
+            _dlsym   = cached->dlsym;
+            _dlerror = cached->dlerror;
+            _calloc  = cached->calloc;
+            _free    = cached->free;
+            _mmap    = cached->mmap;
+            _munmap  = cached->munmap;
+        }
+        else if( !_maps.load( _pid ) ){
+            fprintf( stderr, "Could not read the maps of process %d.\n", _pid );
+        }
+        else {
             /*
              * First thing first, we need to search these functions into the target
-             * process address space.
+             * process address space, all of them are resolved against the same
+             * maps snapshots.
              */
             _dlopen  = findFunction( "/system/bin/linker", (void *)::dlopen );
             _dlsym   = findFunction( "/system/bin/linker", (void *)::dlsym );
             _dlerror = findFunction( "/system/bin/linker", (void *)::dlerror );
             _calloc  = findFunction( "/system/lib/libc.so", (void *)::calloc );
             _free    = findFunction( "/system/lib/libc.so", (void *)::free );
+            _mmap    = findFunction( "/system/lib/libc.so", (void *)::mmap );
+            _munmap  = findFunction( "/system/lib/libc.so", (void *)::munmap );
+        }
 
-            if( !_calloc ){
-                fprintf( stderr, "Could not find calloc symbol.\n" );
-            }
-            else if( !_free ){
-                fprintf( stderr, "Could not find dlopen symbol.\n" );
-            }
-            else if( !_dlopen ){
-                fprintf( stderr, "Could not find dlopen symbol.\n" );
-            }
-            else if( !_dlsym ){
-                fprintf( stderr, "Could not find dlsym symbol.\n" );
+        if( !_calloc ){
+            fprintf( stderr, "Could not find calloc symbol.\n" );
+        }
+        else if( !_free ){
+            fprintf( stderr, "Could not find free symbol.\n" );
+        }
+        else if( !_dlopen ){
+            fprintf( stderr, "Could not find dlopen symbol.\n" );
+        }
+        else if( !_dlsym ){
+            fprintf( stderr, "Could not find dlsym symbol.\n" );
+        }
+        else if( !_dlerror ){
+            fprintf( stderr, "Could not find dlerror symbol.\n" );
+        }
+
+        _started = monotonic();
+
+        if( ptrace( PTRACE_SEIZE, _tid, NULL, NULL ) == 0 ){
+            _seized = true;
+            trace( PTRACE_INTERRUPT );
+        }
+        else if( trace( PTRACE_ATTACH ) == -1 ){
+            fprintf( stderr, "Failed to attach to thread %d of process %d.\n", _tid, _pid );
+            return;
+        }
+
+        if( !waitStop( &status, TRACED_STOP_TIMEOUT ) ){
+            fprintf( stderr, "Thread %d of process %d did not stop.\n", _tid, _pid );
+            ptrace( PTRACE_DETACH, _tid, NULL, NULL );
+            return;
+        }
+
+        _times.attach = monotonic() - _started;
+        _attached = true;
+    }
+
+    bool attached() const {
+        return _attached;
+    }
+
+    traced_symbols_t symbols() const {
+        traced_symbols_t sym = { _dlopen, _dlsym, _dlerror, _calloc, _free, _mmap, _munmap };
+        return sym;
+    }
+
+    bool seized() const {
+        return _seized;
+    }
+
+    // only complete after detach().
+    const traced_times_t& times() const {
+        return _times;
+    }
+
+    // a remote call was interrupted, the caller must not try anything else.
+    bool fatal() const {
+        return _fatal;
+    }
+
+    // put back whatever we changed and let the target go.
+    void detach() {
+        if( !_attached ){
+            return;
+        }
+
+        // give the scratch region back before letting the target go.
+        if( _arena ){
+            if( _arenaMapped ){
+                call( _munmap, 2, _arena, TRACED_ARENA_SIZE );
             }
-            else if( !_dlerror ){
-                fprintf( stderr, "Could not find dlerror symbol.\n" );
+            else {
+                free( _arena );
             }
+
+            _arena = 0;
         }
-        else {
-            fprintf( stderr, "Failed to attach to process %d.", _pid );
-        }
+
+        trace( PTRACE_DETACH );
+
+        _attached = false;
+        _times.total = monotonic() - _started;
     }
 
     virtual ~Traced() {
-        trace( PTRACE_DETACH );
+        detach();
+
+        if( _mem != -1 ){
+            close( _mem );
+        }
     }
 };
 
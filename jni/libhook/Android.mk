@@ -3,7 +3,7 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE    := libhook
-LOCAL_SRC_FILES := main.cpp hook.cpp report.cpp hooks/io.cpp
+LOCAL_SRC_FILES := main.cpp hook.cpp tls.cpp config.cpp report.cpp event.cpp tracefile.cpp reclaim.cpp histogram.cpp stats.cpp sample.cpp mailbox.cpp hooks/io.cpp hooks/dl.cpp
 LOCAL_LDLIBS    := -llog
 
 include $(BUILD_SHARED_LIBRARY)
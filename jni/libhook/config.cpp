@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+#include "hook.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+
+typedef std::map< std::string, std::string > config_map_t;
+
+static config_map_t __config HOOK_EARLY_INIT;
+
+static std::string trim( const std::string& s ) {
+    size_t start = s.find_first_not_of( " \t\r\n" ),
+           end   = s.find_last_not_of( " \t\r\n" );
+
+    return start == std::string::npos ? "" : s.substr( start, end - start + 1 );
+}
+
+bool config_load( const char *path ) {
+    char buffer[1024] = {0};
+
+    FILE *fp = fopen( path, "rt" );
+    if( fp == NULL ){
+        return false;
+    }
+
+    while( fgets( buffer, sizeof(buffer), fp ) ) {
+        std::string line = trim( buffer );
+        size_t eq = line.find( '=' );
+
+        if( line.empty() || line[0] == '#' || eq == std::string::npos ){
+            continue;
+        }
+
+        __config[ trim( line.substr( 0, eq ) ) ] = trim( line.substr( eq + 1 ) );
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+std::string config_get( const char *key, const std::string& def ) {
+    config_map_t::const_iterator i = __config.find( key );
+
+    return i == __config.end() ? def : i->second;
+}
+
+unsigned long config_get( const char *key, unsigned long def ) {
+    config_map_t::const_iterator i = __config.find( key );
+
+    return i == __config.end() ? def : strtoul( i->second.c_str(), NULL, 0 );
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event.h"
+#include <sstream>
+#include <iomanip>
+#include <string.h>
+#include <sched.h>
+
+static event_function_t __functions[EVENT_MAX_FUNCTIONS];
+
+static inline void put( unsigned char *buf, size_t& off, const void *data, size_t size ) {
+    memcpy( buf + off, data, size );
+    off += size;
+}
+
+static inline void get( const unsigned char *buf, size_t& off, void *data, size_t size ) {
+    memcpy( data, buf + off, size );
+    off += size;
+}
+
+static size_t slot_size( char fmt ) {
+    switch( fmt )
+    {
+        case 'i':
+        case 'u':
+            return sizeof(uint32_t);
+
+        case 's':
+            return sizeof(uint16_t);
+
+        default:
+            return sizeof(uintptr_t);
+    }
+}
+
+static void function_fill( event_function_t *fn, const char *argsfmt, va_list va ) {
+    size_t i, argc = strlen(argsfmt);
+    va_list names;
+
+    va_copy( names, va );
+
+    fn->argsfmt = argsfmt;
+    fn->has_ret = false;
+
+    for( i = 0; i < argc && i < EVENT_MAX_ARGS; ++i ){
+        char fmt = argsfmt[i];
+
+        if( fmt == '.' ){
+            fn->has_ret = ( i + 1 < argc );
+            break;
+        }
+
+        fn->names[i] = va_arg( names, const char * );
+
+        // skip the value itself.
+        if( fmt == 'i' || fmt == 'u' ){
+            (void)va_arg( names, unsigned int );
+        }
+        else {
+            (void)va_arg( names, uintptr_t );
+        }
+    }
+
+    fn->argc  = i;
+    fn->fixed = 0;
+
+    for( i = 0; i < fn->argc; ++i ){
+        fn->fixed += slot_size( argsfmt[i] );
+    }
+
+    if( fn->has_ret ){
+        fn->fixed += slot_size( argsfmt[fn->argc + 1] );
+    }
+
+    va_end( names );
+}
+
+int event_function_id( const char *fnname, const char *argsfmt, va_list va ) {
+    // function names are string literals, so their address is enough.
+    size_t start = ( (uintptr_t)fnname >> 2 ) % EVENT_MAX_FUNCTIONS;
+
+    for( size_t n = 0; n < EVENT_MAX_FUNCTIONS; ++n ){
+        size_t i = ( start + n ) % EVENT_MAX_FUNCTIONS;
+        event_function_t *fn = &__functions[i];
+        const char *name = __atomic_load_n( &fn->name, __ATOMIC_ACQUIRE );
+
+        if( name == NULL ){
+            if( __sync_bool_compare_and_swap( &fn->name, (const char *)NULL, fnname ) ){
+                function_fill( fn, argsfmt, va );
+                __atomic_store_n( &fn->ready, 1, __ATOMIC_RELEASE );
+                return i;
+            }
+
+            name = __atomic_load_n( &fn->name, __ATOMIC_ACQUIRE );
+        }
+
+        if( name == fnname ){
+            // somebody else is filling this very same descriptor.
+            while( !__atomic_load_n( &fn->ready, __ATOMIC_ACQUIRE ) ){
+                sched_yield();
+            }
+            return i;
+        }
+    }
+
+    return EVENT_NO_FUNCTION;
+}
+
+const event_function_t *event_function_get( unsigned fnid ) {
+    if( fnid >= EVENT_MAX_FUNCTIONS || !__atomic_load_n( &__functions[fnid].ready, __ATOMIC_ACQUIRE ) ){
+        return NULL;
+    }
+
+    return &__functions[fnid];
+}
+
+size_t event_encode_stream( unsigned char *buf, size_t size, uint64_t started ) {
+    event_header_t hdr = { 0, EVENT_STREAM, 0 };
+    uint32_t magic = EVENT_MAGIC;
+    uint8_t version = EVENT_VERSION,
+            ptrsize = sizeof(uintptr_t);
+    uint16_t reserved = 0;
+    size_t off = sizeof(hdr);
+
+    if( size < sizeof(hdr) + 16 ){
+        return 0;
+    }
+
+    put( buf, off, &magic, sizeof(magic) );
+    put( buf, off, &version, sizeof(version) );
+    put( buf, off, &ptrsize, sizeof(ptrsize) );
+    put( buf, off, &reserved, sizeof(reserved) );
+    put( buf, off, &started, sizeof(started) );
+
+    hdr.size = off;
+    memcpy( buf, &hdr, sizeof(hdr) );
+
+    return off;
+}
+
+size_t event_encode_function( unsigned char *buf, size_t size, unsigned fnid ) {
+    const event_function_t *fn = event_function_get( fnid );
+    event_header_t hdr = { 0, EVENT_FUNCTION, (uint8_t)fnid };
+    size_t off = sizeof(hdr);
+    const char *strings[EVENT_MAX_ARGS + 2];
+    size_t nstrings = 0;
+
+    if( fn == NULL ){
+        return 0;
+    }
+
+    strings[nstrings++] = fn->name;
+    strings[nstrings++] = fn->argsfmt;
+    for( unsigned i = 0; i < fn->argc; ++i ){
+        strings[nstrings++] = fn->names[i];
+    }
+
+    for( size_t i = 0; i < nstrings; ++i ){
+        size_t len = strlen( strings[i] ) + 1;
+        if( off + len > size ){
+            return 0;
+        }
+
+        put( buf, off, strings[i], len );
+    }
+
+    hdr.size = off;
+    memcpy( buf, &hdr, sizeof(hdr) );
+
+    return off;
+}
+
+static void encode_slot( unsigned char *buf, size_t size, size_t& off, size_t& fixed, char fmt, va_list& va ) {
+    fixed -= slot_size( fmt );
+
+    switch( fmt )
+    {
+        case 'i':
+        {
+            int32_t v = va_arg( va, int );
+            put( buf, off, &v, sizeof(v) );
+        }
+        break;
+
+        case 'u':
+        {
+            uint32_t v = va_arg( va, unsigned int );
+            put( buf, off, &v, sizeof(v) );
+        }
+        break;
+
+        case 's':
+        {
+            // strings are truncated to whatever is left once the space for
+            // the remaining fixed size slots has been accounted for.
+            const char *str = va_arg( va, const char * );
+            uint16_t len = str ? strnlen( str, size - off - sizeof(len) - fixed ) : 0;
+
+            put( buf, off, &len, sizeof(len) );
+            if( len ){
+                put( buf, off, str, len );
+            }
+        }
+        break;
+
+        default:
+        {
+            uintptr_t v = va_arg( va, uintptr_t );
+            put( buf, off, &v, sizeof(v) );
+        }
+    }
+}
+
+size_t event_encode_call( unsigned char *buf, size_t size, unsigned fnid, uint64_t ts, pid_t pid, pid_t tid, va_list va ) {
+    const event_function_t *fn = &__functions[fnid];
+    event_header_t hdr = { 0, EVENT_CALL, (uint8_t)fnid };
+    uint32_t upid = pid,
+             utid = tid;
+    size_t off = sizeof(hdr),
+           fixed = fn->fixed;
+    va_list args;
+
+    if( size < off + sizeof(ts) + sizeof(upid) + sizeof(utid) + fixed ){
+        return 0;
+    }
+
+    put( buf, off, &ts, sizeof(ts) );
+    put( buf, off, &upid, sizeof(upid) );
+    put( buf, off, &utid, sizeof(utid) );
+
+    va_copy( args, va );
+
+    for( unsigned i = 0; i < fn->argc; ++i ){
+        // skip the argument name, it's in the function record.
+        (void)va_arg( args, const char * );
+
+        encode_slot( buf, size, off, fixed, fn->argsfmt[i], args );
+    }
+
+    if( fn->has_ret ){
+        encode_slot( buf, size, off, fixed, fn->argsfmt[fn->argc + 1], args );
+    }
+
+    va_end( args );
+
+    hdr.size = off;
+    memcpy( buf, &hdr, sizeof(hdr) );
+
+    return off;
+}
+
+static bool format_slot( const unsigned char *buf, size_t size, size_t& off, char fmt, std::ostringstream& s ) {
+    if( off + slot_size( fmt ) > size ){
+        return false;
+    }
+
+    switch( fmt )
+    {
+        case 'i':
+        {
+            int32_t v;
+            get( buf, off, &v, sizeof(v) );
+            s << std::dec << v << " ";
+        }
+        break;
+
+        case 'u':
+        {
+            uint32_t v;
+            get( buf, off, &v, sizeof(v) );
+            s << std::dec << v << " ";
+        }
+        break;
+
+        case 's':
+        {
+            uint16_t len;
+            get( buf, off, &len, sizeof(len) );
+            if( off + len > size ){
+                return false;
+            }
+
+            s << '"' << std::string( (const char *)buf + off, len ) << '"' << " ";
+            off += len;
+        }
+        break;
+
+        default:
+        {
+            uintptr_t v;
+            get( buf, off, &v, sizeof(v) );
+            s << std::hex << std::setfill('0') << "0x" << v << " ";
+        }
+    }
+
+    return true;
+}
+
+bool event_format_call( const unsigned char *buf, std::string& line ) {
+    event_header_t hdr;
+    uint64_t ts;
+    uint32_t pid, tid;
+    size_t off = 0;
+    std::ostringstream s;
+
+    get( buf, off, &hdr, sizeof(hdr) );
+
+    const event_function_t *fn = event_function_get( hdr.fnid );
+    if( hdr.type != EVENT_CALL || fn == NULL || hdr.size < off + sizeof(ts) + sizeof(pid) + sizeof(tid) ){
+        return false;
+    }
+
+    get( buf, off, &ts, sizeof(ts) );
+    get( buf, off, &pid, sizeof(pid) );
+    get( buf, off, &tid, sizeof(tid) );
+
+    // milliseconds, with nanoseconds resolution.
+    s << "[ ts=" << ts / 1000000 << "." << std::setw(6) << std::setfill('0') << ts % 1000000 << std::setfill(' ') << " pid=" << pid << ", tid=" << tid << " ] " << fn->name << "( ";
+
+    for( unsigned i = 0; i < fn->argc; ++i ){
+        s << fn->names[i] << "=";
+        if( !format_slot( buf, hdr.size, off, fn->argsfmt[i], s ) ){
+            return false;
+        }
+    }
+
+    s << ")";
+
+    if( fn->has_ret ){
+        s << " -> ";
+        if( !format_slot( buf, hdr.size, off, fn->argsfmt[fn->argc + 1], s ) ){
+            return false;
+        }
+    }
+
+    line = s.str();
+
+    return true;
+}
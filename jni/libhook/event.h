@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <string>
+
+/*
+ * Binary trace stream format, every record starts with an event_header_t
+ * and all the fields are stored in native byte order without any padding:
+ *
+ *   EVENT_STREAM   : magic (u32), version (u8), sizeof(uintptr_t) (u8),
+ *                    reserved (u16), wall clock when tracing started in ms (u64).
+ *   EVENT_FUNCTION : function name, arguments format and argument names, each
+ *                    one as a NUL terminated string.
+ *   EVENT_CALL     : monotonic nanoseconds since tracing started (u64), pid (u32),
+ *                    tid (u32) followed by one slot per argument plus the
+ *                    return value, typed by the format characters of the
+ *                    function:
+ *
+ *                      'i' -> i32, 'u' -> u32, 's' -> u16 length + bytes,
+ *                      anything else -> uintptr_t
+ *
+ * A function record is always emitted before the first call referencing its
+ * id, so the stream is self describing and can be decoded offline.
+ */
+
+#define EVENT_MAGIC         0x4B4F4F48 // "HOOK"
+// version 1 had timestamps in milliseconds.
+#define EVENT_VERSION       2
+// maximum number of arguments a function can have.
+#define EVENT_MAX_ARGS      8
+// maximum number of distinct functions that can be reported.
+#define EVENT_MAX_FUNCTIONS 64
+// returned by event_function_id when the functions table is full.
+#define EVENT_NO_FUNCTION   0xFF
+
+typedef enum {
+    EVENT_STREAM   = 1,
+    EVENT_FUNCTION = 2,
+    EVENT_CALL     = 3
+}
+event_type_t;
+
+typedef struct __attribute__((packed))
+{
+    // size of the whole record, header included.
+    uint16_t size;
+    uint8_t  type;
+    uint8_t  fnid;
+}
+event_header_t;
+
+typedef struct
+{
+    const char  *name;
+    const char  *argsfmt;
+    const char  *names[EVENT_MAX_ARGS];
+    unsigned     argc;
+    bool         has_ret;
+    // encoded size of all the slots, without the strings contents.
+    size_t       fixed;
+    volatile int ready;
+}
+event_function_t;
+
+int                     event_function_id( const char *fnname, const char *argsfmt, va_list va );
+const event_function_t *event_function_get( unsigned fnid );
+
+size_t event_encode_stream( unsigned char *buf, size_t size, uint64_t started );
+size_t event_encode_function( unsigned char *buf, size_t size, unsigned fnid );
+size_t event_encode_call( unsigned char *buf, size_t size, unsigned fnid, uint64_t ts, pid_t pid, pid_t tid, va_list va );
+
+bool   event_format_call( const unsigned char *buf, std::string& line );
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "histogram.h"
+#include "hook.h"
+#include <sys/mman.h>
+#include <string.h>
+#include <map>
+
+// maximum number of threads with a table at the same time.
+#define HIST_MAX_TABLES 128
+
+typedef struct
+{
+    // tid of the thread owning this table, 0 if free.
+    volatile pid_t         owner;
+    hist_table_t *volatile table;
+}
+hist_slot_t;
+
+typedef std::pair< unsigned, std::string > hist_key_t;
+typedef std::map< hist_key_t, std::vector<uint64_t> > hist_merged_t;
+
+volatile bool __histograms_enabled = false;
+
+static hist_slot_t            __tables[HIST_MAX_TABLES];
+static unsigned long          __interval = 0;
+static uint64_t               __last = 0;
+static volatile unsigned long __dropped = 0;
+
+static inline unsigned bucket_of( uint64_t v ) {
+    if( v < HIST_SUB ){
+        return v;
+    }
+    else if( v >= ( 1ull << HIST_MAX_BITS ) ){
+        return HIST_BUCKETS - 1;
+    }
+
+    unsigned msb   = 63 - __builtin_clzll( v ),
+             shift = msb - HIST_SUB_BITS;
+
+    return ( shift + 1 ) * HIST_SUB + ( ( v >> shift ) & ( HIST_SUB - 1 ) );
+}
+
+// lowest value falling into the given bucket.
+static uint64_t bucket_value( unsigned b ) {
+    if( b < HIST_SUB ){
+        return b;
+    }
+
+    return (uint64_t)( HIST_SUB + b % HIST_SUB ) << ( b / HIST_SUB - 1 );
+}
+
+static uint32_t hash_name( const char *name ) {
+    uint32_t h = 2166136261u;
+
+    while( *name ){
+        h = ( h ^ (uint8_t)*name++ ) * 16777619u;
+    }
+
+    return h;
+}
+
+void histogram_init( bool enabled, unsigned long interval ) {
+    __interval = interval;
+    __last     = hook_clock();
+
+    __atomic_store_n( &__histograms_enabled, enabled, __ATOMIC_RELEASE );
+}
+
+static hist_table_t *histogram_claim() {
+    pid_t tid = hook_gettid();
+
+    for( size_t i = 0; i < HIST_MAX_TABLES; ++i ){
+        hist_slot_t *slot = &__tables[i];
+
+        if( slot->owner != 0 || !__sync_bool_compare_and_swap( &slot->owner, 0, tid ) ){
+            continue;
+        }
+
+        if( slot->table == NULL ){
+            void *mem = mmap( NULL, sizeof(hist_table_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if( mem == MAP_FAILED ){
+                __atomic_store_n( &slot->owner, 0, __ATOMIC_RELEASE );
+                return NULL;
+            }
+
+            __atomic_store_n( &slot->table, (hist_table_t *)mem, __ATOMIC_RELEASE );
+        }
+
+        return slot->table;
+    }
+
+    return NULL;
+}
+
+void histogram_release( hist_table_t *table ) {
+    for( size_t i = 0; i < HIST_MAX_TABLES; ++i ){
+        if( __tables[i].table == table ){
+            __atomic_store_n( &__tables[i].owner, 0, __ATOMIC_RELEASE );
+            break;
+        }
+    }
+}
+
+void histogram_add( unsigned slot, const char *name, uint64_t elapsed ) {
+    hook_tls_t *tls = hook_tls();
+    hist_table_t *table = NULL;
+    uint32_t hash = 0;
+
+    name = name ? name : "(null)";
+    hash = hash_name( name );
+
+    if( tls == NULL ){
+        return;
+    }
+    else if( ( table = tls->histograms ) == NULL && ( table = tls->histograms = histogram_claim() ) == NULL ){
+        __sync_fetch_and_add( &__dropped, 1 );
+        return;
+    }
+
+    for( size_t n = 0; n < HIST_MAX_KEYS; ++n ){
+        hist_entry_t *e = &table->entries[ ( hash + slot + n ) % HIST_MAX_KEYS ];
+
+        // only the owner thread adds keys, so there's no race here.
+        if( !e->used ){
+            e->slot = slot;
+            e->hash = hash;
+            strncpy( e->name, name, HIST_NAME_LEN - 1 );
+            __atomic_store_n( &e->used, 1, __ATOMIC_RELEASE );
+        }
+        else if( e->slot != slot || e->hash != hash || strncmp( e->name, name, HIST_NAME_LEN - 1 ) != 0 ){
+            continue;
+        }
+
+        unsigned b = bucket_of( elapsed );
+        __atomic_store_n( &e->buckets[b], e->buckets[b] + 1, __ATOMIC_RELAXED );
+        return;
+    }
+
+    __sync_fetch_and_add( &__dropped, 1 );
+}
+
+void histogram_dump() {
+    hist_merged_t merged;
+
+    for( size_t i = 0; i < HIST_MAX_TABLES; ++i ){
+        hist_table_t *table = __atomic_load_n( &__tables[i].table, __ATOMIC_ACQUIRE );
+        if( table == NULL ){
+            continue;
+        }
+
+        for( size_t k = 0; k < HIST_MAX_KEYS; ++k ){
+            hist_entry_t *e = &table->entries[k];
+            if( !__atomic_load_n( &e->used, __ATOMIC_ACQUIRE ) ){
+                continue;
+            }
+
+            std::vector<uint64_t>& buckets = merged[ hist_key_t( e->slot, e->name ) ];
+            buckets.resize( HIST_BUCKETS );
+
+            for( size_t b = 0; b < HIST_BUCKETS; ++b ){
+                buckets[b] += __atomic_load_n( &e->buckets[b], __ATOMIC_RELAXED );
+            }
+        }
+    }
+
+    HOOKLOG( "Latency histograms ( %u keys, %lu dropped samples ):", (unsigned)merged.size(), histogram_dropped() );
+
+    for( hist_merged_t::const_iterator i = merged.begin(), e = merged.end(); i != e; ++i ){
+        const std::vector<uint64_t>& buckets = i->second;
+        static const double quantiles[] = { 0.5, 0.9, 0.99, 1.0 };
+        uint64_t values[4] = {0}, total = 0, seen = 0;
+        size_t q = 0;
+
+        for( size_t b = 0; b < HIST_BUCKETS; ++b ){
+            total += buckets[b];
+        }
+
+        for( size_t b = 0; b < HIST_BUCKETS && q < 4; ++b ){
+            seen += buckets[b];
+            while( q < 4 && buckets[b] && seen >= quantiles[q] * total ){
+                values[q++] = bucket_value( b );
+            }
+        }
+
+        HOOKLOG( "  %s( %s ) n=%llu p50=%lluns p90=%lluns p99=%lluns max=%lluns",
+                 __hooks[i->first.first].name, i->first.second.c_str(), (unsigned long long)total,
+                 (unsigned long long)values[0], (unsigned long long)values[1],
+                 (unsigned long long)values[2], (unsigned long long)values[3] );
+    }
+}
+
+void histogram_tick() {
+    uint64_t now = hook_clock();
+
+    if( __interval && __histograms_enabled && now - __last >= __interval * 1000000ull ){
+        __last = now;
+        histogram_dump();
+    }
+}
+
+unsigned long histogram_dropped() {
+    return __atomic_load_n( &__dropped, __ATOMIC_RELAXED );
+}
+
+// exported so it can be called remotely, e.g. through the injector.
+extern "C" __attribute__ ((visibility ("default"))) void libhook_dump_histograms() {
+    histogram_dump();
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Log-linear latency histograms: values below HIST_SUB get a bucket each,
+ * every following power of two is split into HIST_SUB buckets, so the
+ * relative error is at most 1 / HIST_SUB. Values are nanoseconds and are
+ * clamped to 2^HIST_MAX_BITS ( ~36 minutes ).
+ */
+#define HIST_SUB_BITS 3
+#define HIST_SUB      ( 1 << HIST_SUB_BITS )
+#define HIST_MAX_BITS 41
+#define HIST_BUCKETS  ( ( HIST_MAX_BITS - HIST_SUB_BITS + 1 ) * HIST_SUB )
+// distinct hook + descriptor name pairs a single thread can track.
+#define HIST_MAX_KEYS 32
+// space for the descriptor name of each key.
+#define HIST_NAME_LEN 64
+
+typedef struct
+{
+    // set once the key fields below are published.
+    volatile uint32_t used;
+    unsigned          slot;
+    uint32_t          hash;
+    char              name[HIST_NAME_LEN];
+    volatile uint32_t buckets[HIST_BUCKETS];
+}
+hist_entry_t;
+
+typedef struct
+{
+    hist_entry_t entries[HIST_MAX_KEYS];
+}
+hist_table_t;
+
+// whether latencies should be measured at all.
+extern volatile bool __histograms_enabled;
+
+void          histogram_init( bool enabled, unsigned long interval );
+// record a latency of the current thread for the given hook and descriptor.
+void          histogram_add( unsigned slot, const char *name, uint64_t elapsed );
+// give back the table of an exiting thread, its counts are kept.
+void          histogram_release( hist_table_t *table );
+// dump every interval milliseconds, called by the drain thread.
+void          histogram_tick();
+// merge all the per thread tables and log percentiles for every key.
+void          histogram_dump();
+unsigned long histogram_dropped();
+
+#endif
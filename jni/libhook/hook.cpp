@@ -33,200 +33,413 @@
  */
 #include "hook.h"
 #include <sys/mman.h>
+#include <stdio.h>
+#include <algorithm>
+#include <elf.h>
+
+// relocation types referencing a function, per architecture.
+#if defined(__arm__)
+#   define LD_R_JUMP_SLOT R_ARM_JUMP_SLOT
+#   define LD_R_GLOB_DAT  R_ARM_GLOB_DAT
+#   define LD_R_ABS       R_ARM_ABS32
+#elif defined(__aarch64__)
+#   define LD_R_JUMP_SLOT R_AARCH64_JUMP_SLOT
+#   define LD_R_GLOB_DAT  R_AARCH64_GLOB_DAT
+#   define LD_R_ABS       R_AARCH64_ABS64
+#elif defined(__x86_64__)
+#   define LD_R_JUMP_SLOT R_X86_64_JUMP_SLOT
+#   define LD_R_GLOB_DAT  R_X86_64_GLOB_DAT
+#   define LD_R_ABS       R_X86_64_64
+#elif defined(__i386__)
+#   define LD_R_JUMP_SLOT R_386_JMP_SLOT
+#   define LD_R_GLOB_DAT  R_386_GLOB_DAT
+#   define LD_R_ABS       R_386_32
+#else
+#   error "Unsupported architecture."
+#endif
+
+#if defined(__LP64__)
+#   define LD_R_SYM( I )  ELF64_R_SYM( I )
+#   define LD_R_TYPE( I ) ELF64_R_TYPE( I )
+#else
+#   define LD_R_SYM( I )  ELF32_R_SYM( I )
+#   define LD_R_TYPE( I ) ELF32_R_TYPE( I )
+#endif
+
+static int add_module( struct dl_phdr_info *info, size_t, void *data ) {
+    ld_modules_t *modules = (ld_modules_t *)data;
+
+    for( size_t i = 0; i < info->dlpi_phnum; ++i ){
+        if( info->dlpi_phdr[i].p_type == PT_DYNAMIC ){
+            // the main executable has no name.
+            const char *name = info->dlpi_name && *info->dlpi_name ? info->dlpi_name : "[main]";
+
+            modules->push_back( ld_module_t( info->dlpi_addr, name, (const ElfW(Dyn) *)( info->dlpi_addr + info->dlpi_phdr[i].p_vaddr ) ) );
+            break;
+        }
+    }
+
+    return 0;
+}
+
+ld_modules_t libhook_get_modules() {
+    ld_modules_t modules;
 
+    dl_iterate_phdr( add_module, &modules );
 
-static unsigned elfhash(const char *_name) {
-   const unsigned char *name = (const unsigned char *) _name;
-   unsigned h = 0, g;
-   while(*name) {
-       h = (h << 4) + *name++;
-       g = h & 0xf0000000;
-       h ^= g;
-       h ^= g >> 24;
-   }
-   return h;
+    return modules;
 }
 
-static Elf32_Sym *soinfo_elf_lookup(struct soinfo *si, unsigned hash, const char *name) {
-    Elf32_Sym *symtab = si->symtab;
-    const char *strtab = si->strtab;
-    unsigned n;
+ld_mappings_t libhook_get_mappings() {
+    ld_mappings_t mappings;
+    char buffer[1024] = {0},
+         perms[5] = {0};
+    ld_mapping_t m;
 
-    for( n = si->bucket[hash % si->nbucket]; n != 0; n = si->chain[n] ) {
-        Elf32_Sym *s = symtab + n;
-        if( strcmp(strtab + s->st_name, name) == 0 ) {
-            return s;
-        }
+    FILE *fp = fopen( "/proc/self/maps", "rt" );
+    if( fp == NULL ){
+        perror("fopen");
+        return mappings;
     }
 
-    return NULL;
-}
+    while( fgets( buffer, sizeof(buffer), fp ) ) {
+        if( sscanf( buffer, "%lx-%lx %4s", (unsigned long *)&m.start, (unsigned long *)&m.end, perms ) == 3 ){
+            m.prot = ( perms[0] == 'r' ? PROT_READ : 0 ) |
+                     ( perms[1] == 'w' ? PROT_WRITE : 0 ) |
+                     ( perms[2] == 'x' ? PROT_EXEC : 0 );
 
-static uint32_t  gnuhash(const char *_name) {
-    uint32_t h = 5381;
-    const uint8_t* name = reinterpret_cast<const uint8_t*>(_name);
-    while (*name != 0) {
-        h += (h << 5) + *name++; // h*33 + c = h + h * 32 + c = h + h << 5 + c
+            mappings.push_back( m );
+        }
     }
-    return h;
+
+    fclose(fp);
+
+    return mappings;
 }
 
-static Elf32_Sym *soinfo_gnu_lookup(struct soinfo *si, uint32_t hash, const char *name) 
-{
-    uint32_t h2 = hash >> si->gnu_shift2_;
+// maps are sorted by address, so we can binary search them.
+static const ld_mapping_t *find_mapping( const ld_mappings_t& mappings, uintptr_t address ) {
+    size_t lo = 0, hi = mappings.size();
 
-    uint32_t bloom_mask_bits = sizeof(uintptr_t) * 8;
-    uint32_t word_num = (hash / bloom_mask_bits) & si->gnu_maskwords_;
-    uintptr_t bloom_word = si->gnu_bloom_filter_[word_num];
+    while( lo < hi ) {
+        size_t mid = ( lo + hi ) / 2;
 
-    if ((1 & (bloom_word >> (hash % bloom_mask_bits)) & (bloom_word >> (h2 % bloom_mask_bits))) == 0) {
-        return NULL;
+        if( address < mappings[mid].start ){
+            hi = mid;
+        }
+        else if( address >= mappings[mid].end ){
+            lo = mid + 1;
+        }
+        else {
+            return &mappings[mid];
+        }
     }
 
-    uint32_t n = si->gnu_bucket_[hash % si->gnu_nbucket_];
-    if (n == 0) {
-        return NULL;
-    }
+    return NULL;
+}
 
-    do {
-        Elf32_Sym* s = si->symtab + n;
+static bool compare_patches( const ld_patch_t& a, const ld_patch_t& b ) {
+    return a.address < b.address;
+}
+
+size_t libhook_commit_patches( ld_patches_t& patches, const ld_mappings_t& mappings ) {
+    uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t patched = 0, i = 0, j = 0;
+
+    std::sort( patches.begin(), patches.end(), compare_patches );
+
+    for( i = 0; i < patches.size(); i = j ) {
+        const ld_mapping_t *m = find_mapping( mappings, patches[i].address );
+        uintptr_t start = patches[i].address & ~(pagesize - 1), end;
 
-        if (((si->gnu_chain_[n] ^ hash) >> 1) == 0 &&
-            strcmp(si->strtab + s->st_name, name) == 0) {
-            return s;
+        if( m == NULL ){
+            HOOKLOG( "Address 0x%lX is not mapped.", (unsigned long)patches[i].address );
+            j = i + 1;
+            continue;
         }
-    } while ((si->gnu_chain_[n++] & 1) == 0);
 
-    return NULL;
-}
+        // coalesce every slot living inside the same mapping into a single
+        // page range, so it's only mprotect'ed once.
+        for( j = i + 1; j < patches.size() && patches[j].address < m->end; ++j );
 
-ld_modules_t libhook_get_modules() {
-    ld_modules_t modules;
-    char buffer[1024] = {0};
-    uintptr_t address;
-    std::string name;
+        end = ( patches[j - 1].address + sizeof(uintptr_t) + pagesize - 1 ) & ~(pagesize - 1);
 
-    FILE *fp = fopen( "/proc/self/maps", "rt" );
-    if( fp == NULL ){
-        perror("fopen");
-        goto done;
-    }
+        if( ( m->prot & PROT_WRITE ) == 0 && mprotect( (void *)start, end - start, m->prot | PROT_WRITE ) != 0 ){
+            HOOKLOG( "Could not unprotect 0x%lX-0x%lX.", (unsigned long)start, (unsigned long)end );
+            continue;
+        }
 
-    while( fgets( buffer, sizeof(buffer), fp ) ) {
-        if( strstr( buffer, "r-xp" ) ){
-            address = (uintptr_t)strtoul( buffer, NULL, 16 );
-            name    = strrchr( buffer, ' ' ) + 1;
-            name.resize( name.size() - 1 );
+        for( size_t k = i; k < j; ++k, ++patched ) {
+            patches[k].original = __atomic_exchange_n( (uintptr_t *)patches[k].address, patches[k].value, __ATOMIC_SEQ_CST );
+        }
 
-            modules.push_back( ld_module_t( address, name ) );
+        // restore whatever protection the mapping had.
+        if( ( m->prot & PROT_WRITE ) == 0 ){
+            mprotect( (void *)start, end - start, m->prot );
         }
     }
 
-    done:
+    return patched;
+}
+
+uint32_t libhook_elfhash( const char *name ) {
+    uint32_t h = 0, g;
 
-    if(fp){
-        fclose(fp);
+    while( *name ){
+        h = ( h << 4 ) + (uint8_t)*name++;
+        g = h & 0xf0000000;
+        h ^= g;
+        h ^= g >> 24;
     }
 
-    return modules;
+    return h;
 }
 
-unsigned libhook_patch_address( unsigned addr, unsigned newval ) {
-    unsigned original = -1;
-    size_t pagesize = sysconf(_SC_PAGESIZE);
-    const void *aligned_pointer = (const void*)(addr & ~(pagesize - 1));
-
-    mprotect(aligned_pointer, pagesize, PROT_WRITE | PROT_READ);
+uint32_t libhook_gnuhash( const char *name ) {
+    uint32_t h = 5381;
 
-    original = *(unsigned *)addr;
-    *((unsigned*)addr) = newval;
+    while( *name ){
+        h = h * 33 + (uint8_t)*name++;
+    }
 
-    mprotect(aligned_pointer, pagesize, PROT_READ);
+    return h;
+}
 
-    return original;
+static int compare_symbols( const void *a, const void *b ) {
+    return strcmp( **(const char ***)a, **(const char ***)b );
 }
 
-unsigned libhook_addhook( const char *soname, const char *symbol, unsigned newval ) {
-    struct soinfo *si = NULL;
-    Elf32_Rel *rel = NULL;
-    Elf32_Sym *s = NULL;
-    unsigned int sym_offset = 0;
-    size_t i;
+// binary search a symbol name inside the sorted list of requested ones.
+static const char **find_symbol( const std::vector<const char **>& sorted, const char *name ) {
+    size_t lo = 0, hi = sorted.size();
 
-    // since we know the module is already loaded and mostly
-    // we DO NOT want its constructors to be called again,
-    // ise RTLD_NOLOAD to just get its soinfo address.
-    si = (struct soinfo *)dlopen( soname, 4 /* RTLD_NOLOAD */ );
-    if( !si ){
-        HOOKLOG( "dlopen error: %s.", dlerror() );
-        return 0;
-    }
+    while( lo < hi ) {
+        size_t mid = ( lo + hi ) / 2;
+        int cmp = strcmp( *sorted[mid], name );
 
-    if ((si->flags & FLAG_GNU_HASH) != 0)
-    {
-        s = soinfo_gnu_lookup(si, gnuhash(symbol), symbol);
-    }
-    else
-    {
-        s = soinfo_elf_lookup(si, elfhash(symbol), symbol);
+        if( cmp == 0 ){
+            return sorted[mid];
+        }
+        else if( cmp < 0 ){
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
     }
 
-    if(!s &&
-       // GNU hash table doesn't contain relocation symbols.
-       // We still need to search the .rel.plt section for the symbol
-       (si->flags & FLAG_GNU_HASH) == 0)
-    {
-        return 0;
+    return NULL;
+}
+
+/*
+ * Everything we need from the dynamic section of a module, read straight
+ * from memory so we don't depend on the private soinfo layout.
+ */
+typedef struct
+{
+    const ElfW(Sym) *symtab;
+    const char      *strtab;
+    // DT_JMPREL entries are either REL or RELA, depending on DT_PLTREL.
+    uintptr_t        jmprel;
+    size_t           jmprelsz;
+    bool             jmprela;
+    const ElfW(Rel) *rel;
+    size_t           relsz;
+    const ElfW(Rela)*rela;
+    size_t           relasz;
+    const uint32_t  *gnu_hash;
+    const uint32_t  *hash;
+}
+ld_dynamic_t;
+
+static bool parse_dynamic( const ld_module_t& module, ld_dynamic_t *dyn ) {
+    memset( dyn, 0, sizeof(ld_dynamic_t) );
+
+    for( const ElfW(Dyn) *d = module.dynamic; d->d_tag != DT_NULL; ++d ){
+        // glibc relocates the pointers of the dynamic section while bionic
+        // leaves them relative to the load bias.
+        uintptr_t ptr = d->d_un.d_ptr < module.address ? d->d_un.d_ptr + module.address : d->d_un.d_ptr;
+
+        switch( d->d_tag ){
+            case DT_SYMTAB:   dyn->symtab   = (const ElfW(Sym) *)ptr;  break;
+            case DT_STRTAB:   dyn->strtab   = (const char *)ptr;       break;
+            case DT_JMPREL:   dyn->jmprel   = ptr;                     break;
+            case DT_PLTRELSZ: dyn->jmprelsz = d->d_un.d_val;           break;
+            case DT_PLTREL:   dyn->jmprela  = d->d_un.d_val == DT_RELA; break;
+            case DT_REL:      dyn->rel      = (const ElfW(Rel) *)ptr;  break;
+            case DT_RELSZ:    dyn->relsz    = d->d_un.d_val;           break;
+            case DT_RELA:     dyn->rela     = (const ElfW(Rela) *)ptr; break;
+            case DT_RELASZ:   dyn->relasz   = d->d_un.d_val;           break;
+            case DT_GNU_HASH: dyn->gnu_hash = (const uint32_t *)ptr;   break;
+            case DT_HASH:     dyn->hash     = (const uint32_t *)ptr;   break;
+        }
     }
 
-    sym_offset = s - si->symtab;
+    return dyn->symtab != NULL && dyn->strtab != NULL;
+}
 
-    // loop reloc table to find the symbol by index
-    for( i = 0, rel = si->plt_rel; i < si->plt_rel_count; ++i, ++rel ) {
-        unsigned type  = ELF32_R_TYPE(rel->r_info);
-        unsigned sym   = ELF32_R_SYM(rel->r_info);
-        unsigned reloc = (unsigned)(rel->r_offset + si->load_bias);
+// dynamic symbol index -> index of the requested symbol, sorted.
+typedef std::vector< std::pair<uint32_t, size_t> > ld_symbol_map_t;
 
-        if( sym_offset == sym ||
-            strcmp(si->strtab + ((Elf32_Sym*)(si->symtab + sym))->st_name, symbol) == 0) {
-            switch(type) {
-                case R_ARM_JUMP_SLOT:
+static const std::pair<uint32_t, size_t> *find_index( const ld_symbol_map_t& map, uint32_t sym ) {
+    size_t lo = 0, hi = map.size();
 
-                    return libhook_patch_address( reloc, newval );
+    while( lo < hi ) {
+        size_t mid = ( lo + hi ) / 2;
 
-                default:
+        if( map[mid].first == sym ){
+            return &map[mid];
+        }
+        else if( map[mid].first < sym ){
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
 
-                    HOOKLOG( "Expected R_ARM_JUMP_SLOT, found 0x%X", type );
+    return NULL;
+}
+
+/*
+ * The SysV hash table chains every dynamic symbol, imported ones included,
+ * so with the precomputed hashes each requested symbol costs a single chain
+ * walk, and modules importing none of them are rejected right away.
+ */
+static void map_symbols_sysv( const ld_dynamic_t& dyn, const char **symbols, const uint32_t *hashes, size_t nsymbols, ld_symbol_map_t& map ) {
+    uint32_t nbucket = dyn.hash[0];
+    const uint32_t *buckets = &dyn.hash[2],
+                   *chains  = &dyn.hash[2 + nbucket];
+
+    for( size_t i = 0; i < nsymbols; ++i ){
+        for( uint32_t sym = buckets[ hashes[i] % nbucket ]; sym != 0; sym = chains[sym] ){
+            if( strcmp( dyn.strtab + dyn.symtab[sym].st_name, symbols[i] ) == 0 ){
+                map.push_back( std::make_pair( sym, i ) );
+                break;
             }
         }
     }
+}
 
-    unsigned original = 0;
+/*
+ * The GNU hash table only covers the defined symbols, from symoffset on, which
+ * are found with the precomputed hashes walking a single chain each. Imported
+ * symbols, the ones we usually patch, are all below symoffset and not hashed
+ * at all, so only that range is compared by name.
+ */
+static void map_symbols_gnu( const ld_dynamic_t& dyn, const char **symbols, const uint32_t *hashes, size_t nsymbols, ld_symbol_map_t& map ) {
+    uint32_t nbuckets  = dyn.gnu_hash[0],
+             symoffset = dyn.gnu_hash[1],
+             nbloom    = dyn.gnu_hash[2];
+    const uint32_t *buckets = dyn.gnu_hash + 4 + nbloom * ( sizeof(ElfW(Addr)) / sizeof(uint32_t) ),
+                   *chains  = buckets + nbuckets;
+    std::vector<const char **> sorted( nsymbols );
+
+    for( size_t i = 0; i < nsymbols; ++i ){
+        sorted[i] = &symbols[i];
+    }
 
-    // loop dyn reloc table
-    for( i = 0, rel = si->rel; i < si->rel_count; ++i, ++rel ) {
-        unsigned type  = ELF32_R_TYPE(rel->r_info);
-        unsigned sym   = ELF32_R_SYM(rel->r_info);
-        unsigned reloc = (unsigned)(rel->r_offset + si->load_bias);
+    qsort( &sorted[0], nsymbols, sizeof(sorted[0]), compare_symbols );
 
-        if( sym_offset == sym ||
-            strcmp(si->strtab + ((Elf32_Sym*)(si->symtab + sym))->st_name, symbol) == 0) {
-            switch(type) {
-                case R_ARM_ABS32:
-                case R_ARM_GLOB_DAT:
+    for( uint32_t sym = 1; sym < symoffset; ++sym ){
+        const char **found = find_symbol( sorted, dyn.strtab + dyn.symtab[sym].st_name );
+        if( found ){
+            map.push_back( std::make_pair( sym, (size_t)( found - symbols ) ) );
+        }
+    }
 
-                    original = libhook_patch_address( reloc, newval );
+    for( size_t i = 0; i < nsymbols; ++i ){
+        uint32_t sym = buckets[ hashes[i] % nbuckets ];
 
-                default:
+        // empty bucket.
+        if( sym < symoffset ){
+            continue;
+        }
+
+        // the low bit of a chain entry marks the end of the chain.
+        for( ;; ++sym ){
+            uint32_t h = chains[ sym - symoffset ];
 
-                    HOOKLOG( "Expected R_ARM_ABS32 or R_ARM_GLOB_DAT, found 0x%X", type );
+            if( ( h | 1 ) == ( hashes[i] | 1 ) && strcmp( dyn.strtab + dyn.symtab[sym].st_name, symbols[i] ) == 0 ){
+                map.push_back( std::make_pair( sym, i ) );
+                break;
             }
+            else if( h & 1 ){
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Walk a relocation table picking every slot that references one of the
+ * mapped symbols, jmprel tells whether this is the PLT table or not, so we
+ * know what kind of relocations to expect.
+ */
+template<typename R>
+static void index_table( const ld_module_t& module, const R *table, size_t size, bool jmprel,
+                         const ld_symbol_map_t& map, const char **symbols, ld_relocs_t *relocs ) {
+    for( size_t i = 0, n = size / sizeof(R); i < n; ++i ) {
+        unsigned type  = LD_R_TYPE( table[i].r_info );
+        unsigned sym   = LD_R_SYM( table[i].r_info );
+        uintptr_t reloc = table[i].r_offset + module.address;
+        const std::pair<uint32_t, size_t> *found = NULL;
+
+        if( sym == 0 || ( found = find_index( map, sym ) ) == NULL ){
+            continue;
+        }
+
+        if( jmprel && type == LD_R_JUMP_SLOT ){
+            relocs[ found->second ].push_back( ld_reloc_t( reloc, type ) );
+        }
+        else if( !jmprel && ( type == LD_R_ABS || type == LD_R_GLOB_DAT ) ){
+            relocs[ found->second ].push_back( ld_reloc_t( reloc, type ) );
+        }
+        else {
+            HOOKLOG( "Unexpected relocation type 0x%X for %s in %s.", type, symbols[ found->second ], module.name.c_str() );
         }
     }
+}
+
+bool libhook_index_relocs( const ld_module_t& module, const char **symbols, const uint32_t *hashes, const uint32_t *gnu_hashes,
+                           size_t nsymbols, ld_relocs_t *relocs ) {
+    ld_symbol_map_t map;
+    ld_dynamic_t dyn;
+
+    if( !parse_dynamic( module, &dyn ) ){
+        HOOKLOG( "No symbol table in %s.", module.name.c_str() );
+        return false;
+    }
 
-    if( original == 0 ){
-        HOOKLOG( "Unable to find symbol in the reloc tables ( plt_rel_count=%u - rel_count=%u ).", si->plt_rel_count, si->rel_count );
+    // first resolve the requested names to dynamic symbol indexes once, so
+    // relocations are matched by comparing integers.
+    if( dyn.hash ){
+        map_symbols_sysv( dyn, symbols, hashes, nsymbols, map );
     }
+    else if( dyn.gnu_hash ){
+        map_symbols_gnu( dyn, symbols, gnu_hashes, nsymbols, map );
+    }
+    else {
+        HOOKLOG( "No hash table in %s.", module.name.c_str() );
+        return false;
+    }
+
+    // nothing we're interested in, skip the relocation tables altogether.
+    if( map.empty() ){
+        return true;
+    }
+
+    std::sort( map.begin(), map.end() );
+
+    if( dyn.jmprela ){
+        index_table( module, (const ElfW(Rela) *)dyn.jmprel, dyn.jmprelsz, true, map, symbols, relocs );
+    }
+    else {
+        index_table( module, (const ElfW(Rel) *)dyn.jmprel, dyn.jmprelsz, true, map, symbols, relocs );
+    }
+
+    index_table( module, dyn.rel, dyn.relsz, false, map, symbols, relocs );
+    index_table( module, dyn.rela, dyn.relasz, false, map, symbols, relocs );
 
-    return original;
+    return true;
 }
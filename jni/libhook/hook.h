@@ -36,27 +36,85 @@
 #include <unistd.h>
 #include <string>
 #include <vector>
-#include "linker.h"
+#include <link.h>
+#include "tls.h"
+#include "stats.h"
+#include "hooks/hooks.h"
 
 #define HOOKLOG(F,...) \
     __android_log_print( ANDROID_LOG_INFO, "LIBHOOK", F, __VA_ARGS__ )
 
+// globals with a constructor, built before libhook_main no matter the link
+// order, since it loads the config and starts threads using them.
+#define HOOK_EARLY_INIT __attribute__ ((init_priority(101)))
+
+// the slot index is known at compile time, so this is a single load.
 #define ORIGINAL( TYPENAME, ... ) \
-    ((TYPENAME ## _t)find_original( #TYPENAME ))( __VA_ARGS__ )
+    ((TYPENAME ## _t)__hooks[ HOOK_SLOT( TYPENAME ) ].original)( __VA_ARGS__ )
+
+// same as ORIGINAL, but measuring how long the call takes when latency
+// histograms are enabled.
+#define ORIGINAL_TIMED( TYPENAME, ... ) \
+    ( __guard.begin(), __guard.end( ORIGINAL( TYPENAME, __VA_ARGS__ ) ) )
+
+// record the latency measured by ORIGINAL_TIMED under the given key.
+#define HOOK_LATENCY( NAME, KEY ) \
+    do { \
+        if( __guard.timed() ) \
+            histogram_add( HOOK_SLOT( NAME ), KEY, __guard.elapsed() ); \
+    } while(0)
+
+// account a call in the STATS report mode.
+#define HOOK_STATS( NAME, FD, RET, BYTES ) \
+    do { \
+        if( __stats_enabled ) \
+            stats_add( HOOK_SLOT( NAME ), FD, RET, BYTES ); \
+    } while(0)
 
 #define DEFINEHOOK( RET_TYPE, NAME, ARGS ) \
     typedef RET_TYPE (* NAME ## _t)ARGS; \
     RET_TYPE hook_ ## NAME ARGS
 
-#define ADDHOOK( NAME ) \
-    { #NAME, 0, (uintptr_t)&hook_ ## NAME }
+#define HOOK_FIRST( ... ) \
+    HOOK_FIRST_( __VA_ARGS__, 0 )
+#define HOOK_FIRST_( FIRST, ... ) \
+    FIRST
+
+// must be the first statement of every hook body, if the thread is already
+// inside a hook or the call is sampled out the original function is called
+// with no reporting at all.
+#define HOOK_ENTER( NAME, ... ) \
+    hook_guard_t __guard; \
+    if( __guard.reentered() || __guard.sampled_out( HOOK_SLOT( NAME ), HOOK_FIRST( __VA_ARGS__ ) ) ) \
+        return ORIGINAL( NAME, __VA_ARGS__ )
+
+#define ADDHOOK( NAME, SYSV, GNU ) \
+    { #NAME, 0, (uintptr_t)&hook_ ## NAME, SYSV, GNU },
+
+typedef struct
+{
+    const char *name;
+    uintptr_t   original;
+    uintptr_t   hook;
+    // SysV and GNU ELF hashes of the name, from LIBHOOK_HOOKS.
+    uint32_t    hash;
+    uint32_t    gnu_hash;
+}
+hook_t;
+
+extern hook_t __hooks[NHOOKS];
+
+// name based lookup for dynamic callers, hooks should use ORIGINAL instead.
+uintptr_t find_original( const char *name );
 
 typedef struct ld_module
 {
-    uintptr_t   address;
-    std::string name;
+    // load bias, added to every address found in the ELF structures.
+    uintptr_t        address;
+    std::string      name;
+    const ElfW(Dyn) *dynamic;
 
-    ld_module( uintptr_t a, const std::string& n ) : address(a), name(n) {
+    ld_module( uintptr_t a, const std::string& n, const ElfW(Dyn) *d ) : address(a), name(n), dynamic(d) {
 
     }
 }
@@ -64,7 +122,80 @@ ld_module_t;
 
 typedef std::vector<ld_module_t> ld_modules_t;
 
-ld_modules_t libhook_get_modules();
-unsigned     libhook_addhook( const char *soname, const char *symbol, unsigned newval );
+typedef struct ld_reloc
+{
+    uintptr_t address;
+    unsigned  type;
+
+    ld_reloc( uintptr_t a, unsigned t ) : address(a), type(t) {
+
+    }
+}
+ld_reloc_t;
+
+typedef std::vector<ld_reloc_t> ld_relocs_t;
+
+typedef struct ld_patch
+{
+    uintptr_t address;
+    uintptr_t value;
+    // value of the slot before patching, set by libhook_commit_patches.
+    uintptr_t original;
+    // caller defined, to match patches back after they've been committed.
+    size_t    tag;
+
+    ld_patch( uintptr_t a, uintptr_t v, size_t t ) : address(a), value(v), original(0), tag(t) {
+
+    }
+}
+ld_patch_t;
+
+typedef std::vector<ld_patch_t> ld_patches_t;
+
+typedef struct
+{
+    uintptr_t start;
+    uintptr_t end;
+    int       prot;
+}
+ld_mapping_t;
+
+typedef std::vector<ld_mapping_t> ld_mappings_t;
+
+// one entry for every loaded object with a dynamic section.
+ld_modules_t  libhook_get_modules();
+// snapshot of /proc/self/maps sorted by address, commits don't change it.
+ld_mappings_t libhook_get_mappings();
+/*
+ * Write all the given slots, coalescing them by mapping so that each page
+ * range is made writable and then restored to its original protection only
+ * once. Patches are sorted by address, returns the number of written slots.
+ */
+size_t        libhook_commit_patches( ld_patches_t& patches, const ld_mappings_t& mappings );
+uint32_t      libhook_elfhash( const char *name );
+uint32_t      libhook_gnuhash( const char *name );
+/*
+ * Walk the relocation tables of a loaded module once and collect the GOT
+ * slots referencing any of the given symbols, relocs[i] will be filled with
+ * the slots of symbols[i]. hashes[i] and gnu_hashes[i] must be the SysV and
+ * GNU hashes of symbols[i].
+ */
+bool          libhook_index_relocs( const ld_module_t& module, const char **symbols, const uint32_t *hashes, const uint32_t *gnu_hashes,
+                                    size_t nsymbols, ld_relocs_t *relocs );
+/*
+ * Install the hooks into every loaded module which was not patched yet, safe
+ * to call from any thread. Returns the number of written slots.
+ */
+size_t        libhook_patch_modules();
+/*
+ * Write back the original value of every journaled slot of the given hooks,
+ * or the hook itself, names is a comma separated list, NULL for all of them.
+ * Returns the number of written slots.
+ */
+size_t        libhook_set_hooked( const char *names, bool hooked );
+// forget the modules which are not loaded anymore, called after dlclose.
+void          libhook_forget_modules();
+// apply a toggle requested through the control signal, called by the drain thread.
+void          libhook_control_tick();
 
 #endif
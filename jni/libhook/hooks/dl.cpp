@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "hook.h"
+#include "dl.h"
+#include "report.h"
+
+/*
+ * Libraries loaded after libhook ( and their dependencies ) are patched as
+ * soon as the original function returns, modules which are already patched
+ * are skipped so this only costs the newly loaded ones.
+ */
+DEFINEHOOK( void *, dlopen, (const char *filename, int flag) ) {
+    HOOK_ENTER( dlopen, filename, flag );
+
+    void *handle = ORIGINAL_TIMED( dlopen, filename, flag );
+
+    if( handle ){
+        libhook_patch_modules();
+    }
+
+    HOOK_LATENCY( dlopen, filename );
+
+    report_add( "dlopen", "si.p",
+        "filename", filename,
+        "flag", flag,
+        handle );
+
+    return handle;
+}
+
+// android_extinfo_t is only available on newer platforms, we just pass it on.
+DEFINEHOOK( void *, android_dlopen_ext, (const char *filename, int flag, const void *extinfo) ) {
+    HOOK_ENTER( android_dlopen_ext, filename, flag, extinfo );
+
+    void *handle = ORIGINAL_TIMED( android_dlopen_ext, filename, flag, extinfo );
+
+    if( handle ){
+        libhook_patch_modules();
+    }
+
+    HOOK_LATENCY( android_dlopen_ext, filename );
+
+    report_add( "android_dlopen_ext", "sip.p",
+        "filename", filename,
+        "flag", flag,
+        "extinfo", extinfo,
+        handle );
+
+    return handle;
+}
+
+/*
+ * Once a library is unloaded it must be forgotten right away, since it can be
+ * loaded again at the very same address before the next scan.
+ */
+DEFINEHOOK( int, dlclose, (void *handle) ) {
+    HOOK_ENTER( dlclose, handle );
+
+    int ret = ORIGINAL( dlclose, handle );
+
+    libhook_forget_modules();
+
+    report_add( "dlclose", "p.i",
+        "handle", handle,
+        ret );
+
+    return ret;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HOOKS_H
+#define HOOKS_H
+
+#include "io.h"
+#include "dl.h"
+
+/*
+ * Every hook installed by libhook, the position of each entry is its slot
+ * index inside the hooks table ( see HOOK_SLOT in hook.h ). Each name comes
+ * with its SysV and GNU ELF hashes, so modules are searched without hashing
+ * anything at runtime ( they're checked once at startup ).
+ */
+#define LIBHOOK_HOOKS( HOOK ) \
+    HOOK( open,               0x000766BE, 0x7C9BD777 ) \
+    HOOK( write,              0x007E90A5, 0x10A8B550 ) \
+    HOOK( read,               0x00078B74, 0x7C9D4D41 ) \
+    HOOK( close,              0x006A3695, 0x0F3B9A5B ) \
+    HOOK( connect,            0x0A654BC4, 0xD3764DCF ) \
+    HOOK( send,               0x00079C44, 0x7C9DDB4F ) \
+    HOOK( sendto,             0x079C4BAF, 0x1B81FA72 ) \
+    HOOK( sendmsg,            0x09C4B4E7, 0x8BC12BD6 ) \
+    HOOK( recv,               0x00078BA6, 0x7C9D4D95 ) \
+    HOOK( recvfrom,           0x0BACE0DD, 0xFF3DF269 ) \
+    HOOK( recvmsg,            0x08BAD4E7, 0x3E09C05C ) \
+    HOOK( shutdown,           0x0FCAB14E, 0xFC460361 ) \
+    HOOK( dlopen,             0x06B366BE, 0xF9040207 ) \
+    HOOK( android_dlopen_ext, 0x0FA370C4, 0xCEC24E97 ) \
+    HOOK( dlclose,            0x0B2A36F5, 0x18A916EB )
+
+#define HOOK_SLOT( NAME ) \
+    HOOK_SLOT_ ## NAME
+
+#define DECLARESLOT( NAME, SYSV, GNU ) \
+    HOOK_SLOT( NAME ),
+
+typedef enum {
+    LIBHOOK_HOOKS( DECLARESLOT )
+    NHOOKS
+}
+hook_slot_t;
+
+#endif
@@ -29,76 +29,109 @@
 #include "hook.h"
 #include "io.h"
 #include "report.h"
-#include <map>
+#include "reclaim.h"
+#include "stats.h"
 #include <sstream>
-#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 
-typedef std::map< int, std::string > fds_map_t;
+/*
+ * Entries are immutable once published, replacing or removing one swaps the
+ * table pointer and hands the old entry to the reclaimer, so lookups never
+ * lock nor allocate.
+ */
+typedef struct
+{
+    reclaim_node_t node;
+    // readlink failed, name is just "(fd)".
+    bool           negative;
+    char           name[1];
+}
+fd_entry_t;
 
-static pthread_mutex_t __lock = PTHREAD_MUTEX_INITIALIZER;
-static fds_map_t __descriptors;
+static fd_entry_t *volatile __descriptors[IO_MAX_FDS];
 
-#define LOCK() pthread_mutex_lock(&__lock)
-#define UNLOCK() pthread_mutex_unlock(&__lock)
+static fd_entry_t *io_new_entry( const char *name, bool negative ) {
+    size_t len = strlen(name);
+    fd_entry_t *entry = (fd_entry_t *)malloc( sizeof(fd_entry_t) + len );
 
-extern uintptr_t find_original( const char *name );
+    if( entry ){
+        entry->negative = negative;
+        memcpy( entry->name, name, len + 1 );
+    }
 
-void io_add_descriptor( int fd, const char *name ) {
-    LOCK();
+    return entry;
+}
 
-    __descriptors[fd] = name;
+static void io_swap_descriptor( int fd, fd_entry_t *entry ) {
+    fd_entry_t *old = __atomic_exchange_n( &__descriptors[fd], entry, __ATOMIC_ACQ_REL );
 
-    UNLOCK();
+    if( old ){
+        reclaim_defer( &old->node );
+    }
 }
 
-void io_del_descriptor( int fd ) {
-    LOCK();
-
-    fds_map_t::iterator i = __descriptors.find(fd);
-    if( i != __descriptors.end() ){
-        __descriptors.erase(i);
+void io_add_descriptor( int fd, const char *name ) {
+    if( fd >= 0 && fd < IO_MAX_FDS ){
+        io_swap_descriptor( fd, io_new_entry( name, false ) );
     }
+}
 
-    UNLOCK();
+void io_del_descriptor( int fd ) {
+    if( fd >= 0 && fd < IO_MAX_FDS ){
+        io_swap_descriptor( fd, NULL );
+    }
 }
 
-std::string io_resolve_descriptor( int fd ) {
-    std::string name;
+const char *io_resolve_descriptor( int fd ) {
+    fd_entry_t *entry = NULL;
 
-    LOCK();
+    if( fd < 0 || fd >= IO_MAX_FDS ){
+        return "(untracked)";
+    }
 
-    fds_map_t::iterator i = __descriptors.find(fd);
-    if( i == __descriptors.end() ){
-        // attempt to read descriptor from /proc/self/fd
+    entry = __atomic_load_n( &__descriptors[fd], __ATOMIC_ACQUIRE );
+    if( entry == NULL ){
+        // attempt to read descriptor from /proc/self/fd, failures are cached
+        // as well so we won't try again until the descriptor is closed.
         char descpath[0xFF] = {0},
              descbuff[0xFF] = {0};
+        bool negative = false;
 
-        sprintf( descpath, "/proc/self/fd/%d", fd );
-        if( readlink( descpath, descbuff, 0xFF ) != -1 ){
-            name = descbuff;
+        snprintf( descpath, sizeof(descpath), "/proc/self/fd/%d", fd );
+        if( readlink( descpath, descbuff, sizeof(descbuff) - 1 ) == -1 ){
+            snprintf( descbuff, sizeof(descbuff), "(%d)", fd );
+            negative = true;
         }
-        else {
-            std::ostringstream s;
-            s << "(" << fd << ")";
-            name = s.str();
+
+        entry = io_new_entry( descbuff, negative );
+        if( entry == NULL ){
+            return "(nomem)";
         }
-    }
-    else {
-        name = i->second;
-    }
 
-    UNLOCK();
+        // somebody else resolved it in the meanwhile.
+        if( !__sync_bool_compare_and_swap( &__descriptors[fd], (fd_entry_t *)NULL, entry ) ){
+            free( entry );
+            entry = __atomic_load_n( &__descriptors[fd], __ATOMIC_ACQUIRE );
+            return entry ? entry->name : "(closed)";
+        }
+    }
 
-    return name;
+    return entry->name;
 }
 
 DEFINEHOOK( int, open, (const char *pathname, int flags) ) {
-    int fd = ORIGINAL( open, pathname, flags );
+    HOOK_ENTER( open, pathname, flags );
+
+    int fd = ORIGINAL_TIMED( open, pathname, flags );
 
     if( fd != -1 ){
         io_add_descriptor( fd, pathname );
     }
 
+    HOOK_LATENCY( open, pathname );
+    HOOK_STATS( open, fd, fd, false );
+
     report_add( "open", "si.i",
         "pathname", pathname,
         "flags", flags,
@@ -108,10 +141,15 @@ DEFINEHOOK( int, open, (const char *pathname, int flags) ) {
 }
 
 DEFINEHOOK( ssize_t, read, (int fd, void *buf, size_t count) ) {
-    ssize_t r = ORIGINAL( read, fd, buf, count );
+    HOOK_ENTER( read, fd, buf, count );
+
+    ssize_t r = ORIGINAL_TIMED( read, fd, buf, count );
+
+    HOOK_LATENCY( read, io_resolve_descriptor(fd) );
+    HOOK_STATS( read, fd, r, true );
 
     report_add( "read", "spu.i",
-        "fd", io_resolve_descriptor(fd).c_str(),
+        "fd", io_resolve_descriptor(fd),
         "buf", buf,
         "count", count,
         r );
@@ -120,10 +158,15 @@ DEFINEHOOK( ssize_t, read, (int fd, void *buf, size_t count) ) {
 }
 
 DEFINEHOOK( ssize_t, write, (int fd, const void *buf, size_t len, int flags) ) {
-    ssize_t wrote = ORIGINAL( write, fd, buf, len, flags );
+    HOOK_ENTER( write, fd, buf, len, flags );
+
+    ssize_t wrote = ORIGINAL_TIMED( write, fd, buf, len, flags );
+
+    HOOK_LATENCY( write, io_resolve_descriptor(fd) );
+    HOOK_STATS( write, fd, wrote, true );
 
     report_add( "write", "spui.i",
-        "fd", io_resolve_descriptor(fd).c_str(),
+        "fd", io_resolve_descriptor(fd),
         "buf", buf,
         "len", len,
         "flags", flags,
@@ -133,19 +176,32 @@ DEFINEHOOK( ssize_t, write, (int fd, const void *buf, size_t len, int flags) ) {
 }
 
 DEFINEHOOK( int, close, (int fd) ) {
-    int c = ORIGINAL( close, fd );
+    HOOK_ENTER( close, fd );
+
+    int c = ORIGINAL_TIMED( close, fd );
+
+    HOOK_LATENCY( close, io_resolve_descriptor(fd) );
+    HOOK_STATS( close, fd, c, false );
 
     report_add( "close", "s.i",
-        "fd", io_resolve_descriptor(fd).c_str(),
+        "fd", io_resolve_descriptor(fd),
         c );
 
+    if( __stats_enabled ){
+        stats_close( fd, io_resolve_descriptor(fd) );
+    }
+
+    sample_close( fd );
+
     io_del_descriptor( fd );
 
     return c;
 }
 
 DEFINEHOOK( int, connect, (int sockfd, const struct sockaddr *addr, socklen_t addrlen) ) {
-    int ret = ORIGINAL( connect, sockfd, addr, addrlen );
+    HOOK_ENTER( connect, sockfd, addr, addrlen );
+
+    int ret = ORIGINAL_TIMED( connect, sockfd, addr, addrlen );
 
     struct sockaddr_in *addr_in = (struct sockaddr_in *)addr;
     std::ostringstream s;
@@ -163,8 +219,11 @@ DEFINEHOOK( int, connect, (int sockfd, const struct sockaddr *addr, socklen_t ad
         io_add_descriptor( sockfd, s.str().c_str() );
     }
 
+    HOOK_LATENCY( connect, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( connect, sockfd, ret, false );
+
     report_add( "connect", "spd.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "addr", addr,
         "addrlen", addrlen,
         ret );
@@ -173,10 +232,15 @@ DEFINEHOOK( int, connect, (int sockfd, const struct sockaddr *addr, socklen_t ad
 }
 
 DEFINEHOOK( ssize_t, send, (int sockfd, const void *buf, size_t len, int flags) ) {
-    ssize_t sent = ORIGINAL( send, sockfd, buf, len, flags );
+    HOOK_ENTER( send, sockfd, buf, len, flags );
+
+    ssize_t sent = ORIGINAL_TIMED( send, sockfd, buf, len, flags );
+
+    HOOK_LATENCY( send, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( send, sockfd, sent, true );
 
     report_add( "send", "spui.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "buf", buf,
         "len", len,
         "flags", flags,
@@ -186,10 +250,15 @@ DEFINEHOOK( ssize_t, send, (int sockfd, const void *buf, size_t len, int flags)
 }
 
 DEFINEHOOK( ssize_t, sendto, (int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) ) {
-    ssize_t sent = ORIGINAL( sendto, sockfd, buf, len, flags, dest_addr, addrlen );
+    HOOK_ENTER( sendto, sockfd, buf, len, flags, dest_addr, addrlen );
+
+    ssize_t sent = ORIGINAL_TIMED( sendto, sockfd, buf, len, flags, dest_addr, addrlen );
+
+    HOOK_LATENCY( sendto, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( sendto, sockfd, sent, true );
 
     report_add( "sendto", "spuibu.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "buf", buf,
         "len", len,
         "flags", flags,
@@ -201,10 +270,15 @@ DEFINEHOOK( ssize_t, sendto, (int sockfd, const void *buf, size_t len, int flags
 }
 
 DEFINEHOOK( ssize_t, sendmsg, (int sockfd, const struct msghdr *msg, int flags) ) {
-    ssize_t sent = ORIGINAL( sendmsg, sockfd, msg, flags );
+    HOOK_ENTER( sendmsg, sockfd, msg, flags );
+
+    ssize_t sent = ORIGINAL_TIMED( sendmsg, sockfd, msg, flags );
+
+    HOOK_LATENCY( sendmsg, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( sendmsg, sockfd, sent, true );
 
     report_add( "sendmsg", "spi.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "msg", msg,
         "flags", flags,
         sent );
@@ -213,10 +287,15 @@ DEFINEHOOK( ssize_t, sendmsg, (int sockfd, const struct msghdr *msg, int flags)
 }
 
 DEFINEHOOK( ssize_t, recv, (int sockfd, const void *buf, size_t len, int flags) ) {
-    ssize_t recvd = ORIGINAL( recv, sockfd, buf, len, flags );
+    HOOK_ENTER( recv, sockfd, buf, len, flags );
+
+    ssize_t recvd = ORIGINAL_TIMED( recv, sockfd, buf, len, flags );
+
+    HOOK_LATENCY( recv, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( recv, sockfd, recvd, true );
 
     report_add( "recv", "spui.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "buf", buf,
         "len", len,
         "flags", flags,
@@ -226,10 +305,15 @@ DEFINEHOOK( ssize_t, recv, (int sockfd, const void *buf, size_t len, int flags)
 }
 
 DEFINEHOOK( ssize_t, recvfrom, (int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) ) {
-    ssize_t recvd = ORIGINAL( recvfrom, sockfd, buf, len, flags, dest_addr, addrlen );
+    HOOK_ENTER( recvfrom, sockfd, buf, len, flags, dest_addr, addrlen );
+
+    ssize_t recvd = ORIGINAL_TIMED( recvfrom, sockfd, buf, len, flags, dest_addr, addrlen );
+
+    HOOK_LATENCY( recvfrom, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( recvfrom, sockfd, recvd, true );
 
     report_add( "recvfrom", "spuipu.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "buf", buf,
         "len", len,
         "flags", flags,
@@ -241,10 +325,15 @@ DEFINEHOOK( ssize_t, recvfrom, (int sockfd, const void *buf, size_t len, int fla
 }
 
 DEFINEHOOK( ssize_t, recvmsg, (int sockfd, const struct msghdr *msg, int flags) ) {
-    ssize_t recvd = ORIGINAL( recvmsg, sockfd, msg, flags );
+    HOOK_ENTER( recvmsg, sockfd, msg, flags );
+
+    ssize_t recvd = ORIGINAL_TIMED( recvmsg, sockfd, msg, flags );
+
+    HOOK_LATENCY( recvmsg, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( recvmsg, sockfd, recvd, true );
 
     report_add( "recvmsg", "spi.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "msg", msg,
         "flags", flags,
         recvd );
@@ -253,10 +342,15 @@ DEFINEHOOK( ssize_t, recvmsg, (int sockfd, const struct msghdr *msg, int flags)
 }
 
 DEFINEHOOK( int, shutdown, (int sockfd, int how) ) {
-    int ret = ORIGINAL( shutdown, sockfd, how );
+    HOOK_ENTER( shutdown, sockfd, how );
+
+    int ret = ORIGINAL_TIMED( shutdown, sockfd, how );
+
+    HOOK_LATENCY( shutdown, io_resolve_descriptor(sockfd) );
+    HOOK_STATS( shutdown, sockfd, ret, false );
 
     report_add( "shutdown", "si.i",
-        "sockfd", io_resolve_descriptor(sockfd).c_str(),
+        "sockfd", io_resolve_descriptor(sockfd),
         "how", how,
         ret );
 
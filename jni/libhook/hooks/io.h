@@ -34,6 +34,12 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
+// descriptors above this value are not tracked.
+#define IO_MAX_FDS 32768
+
+// name of a descriptor, resolved through /proc/self/fd if not known.
+const char *io_resolve_descriptor( int fd );
+
 int hook_open(const char *pathname, int flags);
 ssize_t hook_write(int fd, const void *buf, size_t len, int flags);
 ssize_t hook_read(int fd, void *buf, size_t count);
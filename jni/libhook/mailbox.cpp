@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "mailbox.h"
+#include "hook.h"
+#include "tls.h"
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// every request calls the function with all the arguments, extra ones are
+// simply ignored by the callee.
+typedef uintptr_t (*mailbox_fn_t)( uintptr_t, uintptr_t, uintptr_t, uintptr_t );
+
+static mailbox_t      *__box = NULL;
+static char            __path[0xFF] = {0};
+static pthread_once_t  __once = PTHREAD_ONCE_INIT;
+// when this process was forked, 0 if it has no mailbox to create.
+static volatile uint64_t __forked = 0;
+
+static int futex( volatile int32_t *addr, int op, int32_t value ) {
+    // not FUTEX_PRIVATE_FLAG, waiters live in another process.
+    return syscall( __NR_futex, addr, op, value, NULL, NULL, 0 );
+}
+
+static void mailbox_fail( mailbox_t *box, const char *error ) {
+    box->error = -1;
+    strncpy( box->data, error ? error : "unknown error", MAILBOX_DATA_SIZE - 1 );
+    box->data[ MAILBOX_DATA_SIZE - 1 ] = '\0';
+}
+
+static void mailbox_serve( mailbox_t *box ) {
+    char data[MAILBOX_DATA_SIZE];
+    uintptr_t args[MAILBOX_MAX_ARGS] = {0};
+
+    // work on a private copy, the client could still write the shared one.
+    memcpy( data, box->data, sizeof(data) );
+    data[ sizeof(data) - 1 ] = '\0';
+
+    box->error  = 0;
+    box->result = 0;
+
+    switch( box->op ){
+        case MAILBOX_DLOPEN:
+            if( ( box->result = (uintptr_t)dlopen( data, (int)box->args[0] ) ) == 0 ){
+                mailbox_fail( box, dlerror() );
+            }
+            // libhook's own calls never go through the dl hooks, so the new
+            // modules are patched here.
+            else {
+                libhook_patch_modules();
+            }
+        break;
+
+        case MAILBOX_DLSYM:
+            if( ( box->result = (uintptr_t)dlsym( (void *)(uintptr_t)box->args[0], data ) ) == 0 ){
+                mailbox_fail( box, dlerror() );
+            }
+        break;
+
+        case MAILBOX_CALL:
+            if( box->function == 0 || box->nargs > MAILBOX_MAX_ARGS ){
+                mailbox_fail( box, "invalid call" );
+                break;
+            }
+
+            for( uint32_t i = 0; i < box->nargs; ++i ){
+                if( ( box->strings & ( 1 << i ) ) == 0 ){
+                    args[i] = (uintptr_t)box->args[i];
+                }
+                else if( box->args[i] < sizeof(data) ){
+                    args[i] = (uintptr_t)&data[ box->args[i] ];
+                }
+                else {
+                    mailbox_fail( box, "invalid string argument" );
+                    return;
+                }
+            }
+
+            box->result = ((mailbox_fn_t)(uintptr_t)box->function)( args[0], args[1], args[2], args[3] );
+        break;
+
+        default:
+            mailbox_fail( box, "unknown request" );
+    }
+}
+
+static void *mailbox_service( void *p ) {
+    mailbox_t *box = (mailbox_t *)p;
+    // whatever a request goes through must not be traced.
+    hook_guard_t guard;
+
+    box->tid = hook_gettid();
+    // clients only trust the mailbox once it's served.
+    __atomic_store_n( &box->magic, MAILBOX_MAGIC, __ATOMIC_RELEASE );
+
+    for(;;){
+        int32_t state = __atomic_load_n( &box->state, __ATOMIC_ACQUIRE );
+
+        // sleep until a client changes the state, no polling at all.
+        if( state != MAILBOX_REQUEST || !__sync_bool_compare_and_swap( &box->state, MAILBOX_REQUEST, MAILBOX_BUSY ) ){
+            futex( &box->state, FUTEX_WAIT, state );
+            continue;
+        }
+
+        mailbox_serve( box );
+
+        // nobody is waiting for an abandoned request anymore.
+        if( !__sync_bool_compare_and_swap( &box->state, MAILBOX_BUSY, MAILBOX_DONE ) ){
+            __atomic_store_n( &box->state, MAILBOX_IDLE, __ATOMIC_RELEASE );
+        }
+
+        futex( &box->state, FUTEX_WAKE, INT_MAX );
+    }
+
+    return NULL;
+}
+
+static bool mailbox_create() {
+    pthread_t      thread;
+    pthread_attr_t attr;
+    mailbox_t     *box = NULL;
+    bool           started = false;
+    struct stat    st;
+
+    snprintf( __path, sizeof(__path), MAILBOX_PATH, getpid() );
+
+    // anyone can write in the directory and the mailbox runs whatever it's
+    // asked to, so it must be a brand new file of ours and nobody else's:
+    // whatever is there is removed and a symlink or a file planted after
+    // that makes the creation fail.
+    unlink( __path );
+
+    int fd = open( __path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600 );
+    if( fd == -1 ){
+        HOOKLOG( "[%d] !!! COULD NOT CREATE MAILBOX %s !!!", getpid(), __path );
+        return false;
+    }
+
+    if( fstat( fd, &st ) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || ( st.st_mode & 077 ) ){
+        HOOKLOG( "[%d] !!! MAILBOX %s IS NOT PRIVATE, DISABLED !!!", getpid(), __path );
+        close( fd );
+        return false;
+    }
+
+    if( ftruncate( fd, sizeof(mailbox_t) ) == 0 ){
+        box = (mailbox_t *)mmap( NULL, sizeof(mailbox_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    }
+
+    close( fd );
+
+    if( box == NULL || box == MAP_FAILED ){
+        HOOKLOG( "[%d] !!! COULD NOT MAP MAILBOX %s !!!", getpid(), __path );
+        unlink( __path );
+        return false;
+    }
+
+    box->version = MAILBOX_VERSION;
+    box->pid     = getpid();
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+    started = ( pthread_create( &thread, &attr, mailbox_service, box ) == 0 );
+
+    pthread_attr_destroy( &attr );
+
+    if( !started ){
+        HOOKLOG( "[%d] !!! COULD NOT START THE MAILBOX THREAD !!!", getpid() );
+        munmap( box, sizeof(mailbox_t) );
+        unlink( __path );
+        return false;
+    }
+
+    __box = box;
+
+    return true;
+}
+
+static void mailbox_atfork_child() {
+    // the mapping is shared with the parent and its service thread is gone,
+    // the child gets a mailbox of its own later on, see mailbox_tick.
+    if( __box ){
+        munmap( __box, sizeof(mailbox_t) );
+        __box = NULL;
+    }
+    // or forked from a child which didn't get its own yet.
+    else if( __forked == 0 ){
+        return;
+    }
+
+    __atomic_store_n( &__forked, hook_clock(), __ATOMIC_RELEASE );
+}
+
+static void mailbox_setup() {
+    pthread_atfork( NULL, NULL, mailbox_atfork_child );
+
+    mailbox_create();
+}
+
+bool mailbox_init() {
+    pthread_once( &__once, mailbox_setup );
+
+    return __box != NULL;
+}
+
+void mailbox_tick() {
+    uint64_t forked = __atomic_load_n( &__forked, __ATOMIC_ACQUIRE );
+
+    if( forked && hook_clock() - forked >= MAILBOX_FORK_DELAY_MS * 1000000ull ){
+        __forked = 0;
+        mailbox_create();
+    }
+}
+
+static void __attribute__ ((destructor)) mailbox_fini() {
+    if( __box ){
+        unlink( __path );
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef MAILBOX_H_
+#define MAILBOX_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Shared memory command channel between the injector and an injected libhook,
+ * a MAP_SHARED file with a single request slot served by a dedicated thread.
+ * Once libhook is loaded, dlopen, dlsym and function calls requested through
+ * it run inside the target with no ptrace stop at all.
+ *
+ * This header is also included by the injector, it only describes the layout.
+ *
+ * Clients take the mailbox by swapping 'owner' from 0 to their pid, write the
+ * request and move 'state' from IDLE to REQUEST, the service thread moves it
+ * to BUSY and then DONE, and the client reads the result and moves it back to
+ * IDLE before releasing 'owner'. Both words are futexes, whoever changes one
+ * wakes its waiters. A client giving up on a BUSY request sets ABANDONED and
+ * the service thread resets it to IDLE once done, so a new owner only writes
+ * its request once 'state' is IDLE again.
+ */
+#define MAILBOX_PATH      "/data/local/tmp/libhook.%d.mailbox"
+#define MAILBOX_MAGIC     0x584F424DU
+#define MAILBOX_VERSION   1
+// max size of the strings of a request.
+#define MAILBOX_DATA_SIZE 4096
+// arguments of MAILBOX_CALL functions.
+#define MAILBOX_MAX_ARGS  4
+
+typedef enum {
+    MAILBOX_IDLE      = 0,
+    MAILBOX_REQUEST   = 1,
+    MAILBOX_BUSY      = 2,
+    MAILBOX_DONE      = 3,
+    MAILBOX_ABANDONED = 4
+}
+mailbox_state_t;
+
+typedef enum {
+    // dlopen( data, args[0] )
+    MAILBOX_DLOPEN = 1,
+    // dlsym( args[0], data )
+    MAILBOX_DLSYM  = 2,
+    // function( args[0], ... ) with nargs arguments, the ones flagged in
+    // 'strings' are offsets inside data and are passed as pointers.
+    MAILBOX_CALL   = 3
+}
+mailbox_op_t;
+
+typedef struct
+{
+    uint32_t          magic;
+    uint32_t          version;
+    // process and service thread, so a stale file can be told apart.
+    int32_t           pid;
+    int32_t           tid;
+    volatile int32_t  owner;
+    volatile int32_t  state;
+    uint32_t          op;
+    uint32_t          nargs;
+    uint32_t          strings;
+    // 0 on success, otherwise data holds an error message.
+    int32_t           error;
+    uint64_t          function;
+    uint64_t          args[MAILBOX_MAX_ARGS];
+    uint64_t          result;
+    char              data[MAILBOX_DATA_SIZE];
+}
+mailbox_t;
+
+// milliseconds a forked child must live before it gets a mailbox of its own,
+// so children which exec or exit right away never create one.
+#define MAILBOX_FORK_DELAY_MS 1000
+
+// create the mailbox of this process and start its service thread.
+bool mailbox_init();
+// create the mailbox of a forked child once it's old enough, called by the
+// drain thread.
+void mailbox_tick();
+
+#endif
@@ -27,72 +27,381 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include "hook.h"
-#include "hooks/io.h"
+#include "config.h"
+#include "report.h"
+#include "mailbox.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <set>
+#include <map>
 
-typedef struct
-{
-    const char *name;
-    uintptr_t   original;
-    uintptr_t   hook;
-}
-hook_t;
-
-static hook_t __hooks[] = {
-
-    ADDHOOK( open ),
-    ADDHOOK( write ),
-    ADDHOOK( read ),
-    ADDHOOK( close ),
-    ADDHOOK( connect ),
-    ADDHOOK( send ),
-    ADDHOOK( sendto ),
-    ADDHOOK( sendmsg ),
-    ADDHOOK( recv ),
-    ADDHOOK( recvfrom ),
-    ADDHOOK( recvmsg ),
-    ADDHOOK( shutdown )
+// modules are identified by load address and path, keys of unloaded modules
+// are dropped on every scan, so a library which is unloaded and then loaded
+// again, wherever it lands, gets patched again.
+typedef std::pair<uintptr_t, std::string> ld_module_key_t;
+typedef std::set<ld_module_key_t> ld_module_keys_t;
+typedef std::map<ld_module_key_t, ld_patches_t> ld_journal_t;
+
+// indexed by hook_slot_t.
+hook_t __hooks[NHOOKS] = {
+    LIBHOOK_HOOKS( ADDHOOK )
 };
 
-#define NHOOKS ( sizeof(__hooks) / sizeof(__hooks[0] ) )
+// slot indexes sorted by hook name, for find_original.
+static size_t __by_name[NHOOKS];
+// modules already scanned by libhook_patch_modules.
+static ld_module_keys_t          __patched HOOK_EARLY_INIT;
+static pthread_mutex_t           __patch_lock = PTHREAD_MUTEX_INITIALIZER;
+// every slot written with its original value, to unhook and rehook, by
+// module so the slots of an unloaded one are never written again.
+static ld_journal_t              __journal HOOK_EARLY_INIT;
+// hooks currently installed, by slot.
+static bool                      __hooked[NHOOKS];
+// set by the control signal handler, applied by the drain thread.
+static volatile sig_atomic_t     __toggle = 0;
+static bool                      __toggled_off = false;
 
-uintptr_t find_original( const char *name ) {
+static int compare_hooks( const void *a, const void *b ) {
+    return strcmp( __hooks[ *(const size_t *)a ].name, __hooks[ *(const size_t *)b ].name );
+}
+
+static void sort_hooks() {
     for( size_t i = 0; i < NHOOKS; ++i ) {
-        if( strcmp( __hooks[i].name, name ) == 0 ){
-            return __hooks[i].original;
+        __by_name[i] = i;
+
+        // a wrong hash in LIBHOOK_HOOKS would silently leave the hook out.
+        if( __hooks[i].hash != libhook_elfhash( __hooks[i].name ) || __hooks[i].gnu_hash != libhook_gnuhash( __hooks[i].name ) ){
+            HOOKLOG( "[%d] !!! WRONG HASHES FOR HOOK '%s' !!!", getpid(), __hooks[i].name );
+
+            __hooks[i].hash     = libhook_elfhash( __hooks[i].name );
+            __hooks[i].gnu_hash = libhook_gnuhash( __hooks[i].name );
+        }
+    }
+
+    qsort( __by_name, NHOOKS, sizeof(size_t), compare_hooks );
+}
+
+static int find_slot( const char *name ) {
+    size_t lo = 0, hi = NHOOKS;
+
+    while( lo < hi ) {
+        size_t mid = ( lo + hi ) / 2;
+        int cmp = strcmp( __hooks[ __by_name[mid] ].name, name );
+
+        if( cmp == 0 ){
+            return __by_name[mid];
+        }
+        else if( cmp < 0 ){
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
         }
     }
 
+    return -1;
+}
+
+uintptr_t find_original( const char *name ) {
+    int slot = find_slot( name );
+
+    if( slot != -1 ){
+        return __hooks[slot].original;
+    }
+
     HOOKLOG( "[%d] !!! COULD NOT FIND ORIGINAL POINTER OF FUNCTION '%s' !!!", getpid(), name );
 
     return 0;
 }
 
-void __attribute__ ((constructor)) libhook_main()
-{
-    HOOKLOG( "LIBRARY LOADED FROM PID %d.", getpid() );
+// forget the modules which are not loaded anymore.
+static void prune_modules( const ld_modules_t& modules ) {
+    ld_module_keys_t loaded;
+
+    for( ld_modules_t::const_iterator i = modules.begin(), e = modules.end(); i != e; ++i ){
+        loaded.insert( ld_module_key_t( i->address, i->name ) );
+    }
+
+    for( ld_module_keys_t::iterator i = __patched.begin(); i != __patched.end(); ){
+        if( loaded.count( *i ) == 0 ){
+            __patched.erase( i++ );
+        }
+        else {
+            ++i;
+        }
+    }
+
+    // whatever is mapped there now is not what we journaled.
+    for( ld_journal_t::iterator i = __journal.begin(); i != __journal.end(); ){
+        if( loaded.count( i->first ) == 0 ){
+            __journal.erase( i++ );
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+size_t libhook_patch_modules() {
+    const char *symbols[NHOOKS];
+    uint32_t hashes[NHOOKS],
+             gnu_hashes[NHOOKS];
+    ld_relocs_t relocs[NHOOKS];
+    ld_patches_t patches;
+    ld_mappings_t mappings;
+    bool mapped = false;
+    size_t patched = 0;
+
+    pthread_mutex_lock( &__patch_lock );
 
     // get a list of all loaded modules inside this process.
     ld_modules_t modules = libhook_get_modules();
 
-    HOOKLOG( "Found %u loaded modules.", modules.size() );
-    HOOKLOG( "Installing %u hooks.", NHOOKS );
+    prune_modules( modules );
+
+    for( size_t j = 0; j < NHOOKS; ++j ) {
+        symbols[j]    = __hooks[j].name;
+        hashes[j]     = __hooks[j].hash;
+        gnu_hashes[j] = __hooks[j].gnu_hash;
+    }
 
     for( ld_modules_t::const_iterator i = modules.begin(), e = modules.end(); i != e; ++i ){
         // don't hook ourself :P
-        if( i->name.find( "libhook.so" ) == std::string::npos ) {
-            HOOKLOG( "[0x%X] Hooking %s ...", i->address, i->name.c_str() );
+        if( i->name.find( "libhook.so" ) != std::string::npos ) {
+            continue;
+        }
+        // never scan a module twice, even if it had nothing to patch.
+        else if( !__patched.insert( ld_module_key_t( i->address, i->name ) ).second ){
+            continue;
+        }
+
+        ld_patches_t& journal = __journal[ ld_module_key_t( i->address, i->name ) ];
+
+        HOOKLOG( "[0x%lX] Hooking %s ...", (unsigned long)i->address, i->name.c_str() );
+
+        patches.clear();
+        for( size_t j = 0; j < NHOOKS; ++j ) {
+            relocs[j].clear();
+        }
+
+        // a single pass on the module relocations for all the hooks.
+        if( !libhook_index_relocs( *i, symbols, hashes, gnu_hashes, NHOOKS, relocs ) ){
+            continue;
+        }
+
+        for( size_t j = 0; j < NHOOKS; ++j ) {
+            for( ld_relocs_t::const_iterator r = relocs[j].begin(), re = relocs[j].end(); r != re; ++r ) {
+                patches.push_back( ld_patch_t( r->address, __hooks[j].hook, j ) );
+            }
+        }
+
+        // resolve the original pointers before any slot goes live, with eager
+        // binding the GOT already holds them.
+        for( ld_patches_t::const_iterator p = patches.begin(), pe = patches.end(); p != pe; ++p ) {
+            hook_t *hook = &__hooks[p->tag];
+            uintptr_t original = *(uintptr_t *)p->address;
 
-            for( size_t j = 0; j < NHOOKS; ++j ) {
-                unsigned tmp = libhook_addhook( i->name.c_str(), __hooks[j].name, __hooks[j].hook );
+            // update the original pointer only if the reference we found is valid
+            // and the pointer itself doesn't have a value yet.
+            if( hook->original == 0 && original != 0 && original != hook->hook ){
+                __atomic_store_n( &hook->original, original, __ATOMIC_RELEASE );
 
-                // update the original pointer only if the reference we found is valid
-                // and the pointer itself doesn't have a value yet.
-                if( __hooks[j].original == 0 && tmp != 0 ){
-                    __hooks[j].original = (uintptr_t)tmp;
+                HOOKLOG( "  %s - 0x%lx -> 0x%lx", hook->name, (unsigned long)hook->original, (unsigned long)hook->hook );
+            }
+        }
 
-                    HOOKLOG( "  %s - 0x%x -> 0x%x", __hooks[j].name, __hooks[j].original, __hooks[j].hook );
+        // slots of unhooked functions are only journaled, rehooking them
+        // will write them.
+        ld_patches_t live;
+
+        for( ld_patches_t::iterator p = patches.begin(), pe = patches.end(); p != pe; ++p ) {
+            if( __hooked[p->tag] ){
+                live.push_back( *p );
+            }
+            else {
+                p->original = *(uintptr_t *)p->address;
+                journal.push_back( *p );
+            }
+        }
+
+        // the hooks go live module by module, writing all of its slots at once.
+        if( !live.empty() ){
+            // parsed once per pass and only if there's anything to write.
+            if( !mapped ){
+                mappings = libhook_get_mappings();
+                mapped = true;
+            }
+
+            patched += libhook_commit_patches( live, mappings );
+
+            for( ld_patches_t::const_iterator p = live.begin(), pe = live.end(); p != pe; ++p ) {
+                if( p->original ){
+                    journal.push_back( *p );
                 }
             }
         }
     }
+
+    pthread_mutex_unlock( &__patch_lock );
+
+    return patched;
+}
+
+void libhook_forget_modules() {
+    pthread_mutex_lock( &__patch_lock );
+
+    // taken under the lock, a module patched by a concurrent pass must be in
+    // the list or it would be forgotten and its hooked slots journaled again.
+    prune_modules( libhook_get_modules() );
+
+    pthread_mutex_unlock( &__patch_lock );
+}
+
+// parse a comma separated list of hook names, NULL selects all of them.
+static void select_hooks( const char *names, bool *selected ) {
+    std::string list( names ? names : "" );
+    char *save = NULL;
+
+    for( size_t i = 0; i < NHOOKS; ++i ) {
+        selected[i] = ( names == NULL );
+    }
+
+    list += '\0';
+    for( char *name = strtok_r( &list[0], ", ", &save ); name; name = strtok_r( NULL, ", ", &save ) ){
+        int slot = find_slot( name );
+        if( slot == -1 ){
+            HOOKLOG( "[%d] Unknown hook '%s'.", getpid(), name );
+        }
+        else {
+            selected[slot] = true;
+        }
+    }
+}
+
+size_t libhook_set_hooked( const char *names, bool hooked ) {
+    bool selected[NHOOKS];
+    ld_patches_t patches;
+    size_t written = 0;
+
+    select_hooks( names, selected );
+
+    pthread_mutex_lock( &__patch_lock );
+
+    // a module could have been unloaded without going through our dlclose.
+    prune_modules( libhook_get_modules() );
+
+    for( ld_journal_t::const_iterator m = __journal.begin(), me = __journal.end(); m != me; ++m ) {
+        for( ld_patches_t::const_iterator p = m->second.begin(), pe = m->second.end(); p != pe; ++p ) {
+            if( selected[p->tag] && __hooked[p->tag] != hooked ){
+                patches.push_back( ld_patch_t( p->address, hooked ? p->value : p->original, p->tag ) );
+            }
+        }
+    }
+
+    for( size_t i = 0; i < NHOOKS; ++i ) {
+        if( selected[i] ){
+            __hooked[i] = hooked;
+        }
+    }
+
+    if( !patches.empty() ){
+        written = libhook_commit_patches( patches, libhook_get_mappings() );
+    }
+
+    pthread_mutex_unlock( &__patch_lock );
+
+    HOOKLOG( "[%d] %s %lu slots.", getpid(), hooked ? "Rehooked" : "Unhooked", (unsigned long)written );
+
+    return written;
+}
+
+static void libhook_control_signal( int ) {
+    __toggle = 1;
+}
+
+void libhook_control_tick() {
+    if( __toggle ){
+        __toggle = 0;
+        __toggled_off = !__toggled_off;
+
+        libhook_set_hooked( NULL, !__toggled_off );
+    }
+}
+
+// exported so tracing can be switched on and off at runtime, e.g. through
+// the injector, names is a comma separated list of hooks or NULL for all.
+extern "C" __attribute__ ((visibility ("default"))) int libhook_unhook( const char *names ) {
+    return libhook_set_hooked( names, false );
+}
+
+extern "C" __attribute__ ((visibility ("default"))) int libhook_rehook( const char *names ) {
+    return libhook_set_hooked( names, true );
+}
+
+/*
+ * Scanning and patching every loaded module takes a while, and the thread
+ * running the constructor is the one the injector hijacked and holds inside
+ * dlopen, so it's done here while the target goes on.
+ */
+static void *libhook_installer( void * ) {
+    // anything we go through while patching must not be traced.
+    hook_guard_t guard;
+    uint64_t started = hook_clock();
+
+    // the first trace segment must be ready before any hook goes live.
+    report_prepare();
+
+    size_t patched = libhook_patch_modules();
+
+    HOOKLOG( "Patched %lu slots in %llu ms.", (unsigned long)patched, (unsigned long long)( hook_clock() - started ) / 1000000 );
+
+    return NULL;
+}
+
+void __attribute__ ((constructor)) libhook_main()
+{
+    pthread_t      thread;
+    pthread_attr_t attr;
+
+    HOOKLOG( "LIBRARY LOADED FROM PID %d.", getpid() );
+
+    sort_hooks();
+    config_load( LIBHOOK_CONFIG );
+
+    // hooks listed in hooks.disabled start unhooked, yet their slots are
+    // journaled so they can be rehooked later.
+    bool disabled[NHOOKS];
+
+    select_hooks( config_get( "hooks.disabled", std::string("") ).c_str(), disabled );
+    for( size_t i = 0; i < NHOOKS; ++i ) {
+        __hooked[i] = !disabled[i];
+    }
+
+    // the control signal toggles all the hooks on and off.
+    unsigned long signo = config_get( "control.signal", 0ul );
+    if( signo ){
+        signal( signo, libhook_control_signal );
+    }
+
+    // start the report drain thread before any hook can fire.
+    report_init();
+
+    // later requests from the injector are served through the mailbox
+    // instead of stopping the process again.
+    if( config_get( "mailbox", 1ul ) ){
+        mailbox_init();
+    }
+
+    HOOKLOG( "Installing %u hooks.", NHOOKS );
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+    if( pthread_create( &thread, &attr, libhook_installer, NULL ) != 0 ){
+        HOOKLOG( "[%d] !!! COULD NOT START THE INSTALLER THREAD, PATCHING INLINE !!!", getpid() );
+        libhook_installer( NULL );
+    }
+
+    pthread_attr_destroy( &attr );
 }
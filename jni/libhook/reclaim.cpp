@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "reclaim.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// starts at 1, 0 marks a reader outside of hooks.
+volatile unsigned long          __reclaim_epoch = 1;
+
+static reclaim_node_t *volatile __retired = NULL;
+// retired objects not freed yet, newest first.
+static reclaim_node_t          *__pending = NULL;
+static reclaim_reader_t        *__readers = NULL;
+static pthread_mutex_t          __lock = PTHREAD_MUTEX_INITIALIZER;
+static long int                 __last = 0;
+
+void reclaim_defer( reclaim_node_t *node ) {
+    reclaim_node_t *head;
+
+    do {
+        head = __atomic_load_n( &__retired, __ATOMIC_RELAXED );
+        node->next = head;
+    }
+    while( !__sync_bool_compare_and_swap( &__retired, head, node ) );
+}
+
+void reclaim_register( reclaim_reader_t *reader ) {
+    pthread_mutex_lock( &__lock );
+
+    reader->next = __readers;
+    __readers = reader;
+
+    pthread_mutex_unlock( &__lock );
+}
+
+void reclaim_unregister( reclaim_reader_t *reader ) {
+    pthread_mutex_lock( &__lock );
+
+    for( reclaim_reader_t **link = &__readers; *link; link = &(*link)->next ){
+        if( *link == reader ){
+            *link = reader->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &__lock );
+}
+
+void reclaim_atfork_child( reclaim_reader_t *self ) {
+    pthread_mutex_init( &__lock, NULL );
+
+    // the other threads are gone, whatever hook they were in as well.
+    __readers = self;
+    if( self ){
+        self->next = NULL;
+    }
+}
+
+void reclaim_tick() {
+    struct timespec ts;
+    long int now;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    now = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    if( now - __last < RECLAIM_PERIOD_MS ){
+        return;
+    }
+
+    __last = now;
+
+    unsigned long epoch = __reclaim_epoch,
+                  oldest = epoch + 1;
+    reclaim_node_t *batch = __atomic_exchange_n( &__retired, (reclaim_node_t *)NULL, __ATOMIC_ACQ_REL );
+
+    if( batch ){
+        reclaim_node_t *tail = batch;
+
+        for( ;; tail = tail->next ){
+            tail->epoch = epoch;
+            if( tail->next == NULL ){
+                break;
+            }
+        }
+
+        tail->next = __pending;
+        __pending = batch;
+    }
+
+    // readers entering from now on can't find anything retired so far.
+    __atomic_store_n( &__reclaim_epoch, epoch + 1, __ATOMIC_RELEASE );
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+    pthread_mutex_lock( &__lock );
+
+    for( reclaim_reader_t *reader = __readers; reader; reader = reader->next ){
+        unsigned long entered = __atomic_load_n( &reader->epoch, __ATOMIC_ACQUIRE );
+
+        if( entered && entered < oldest ){
+            oldest = entered;
+        }
+    }
+
+    pthread_mutex_unlock( &__lock );
+
+    // everything retired before the oldest reader entered is safe to free.
+    reclaim_node_t **link = &__pending;
+    while( *link && (*link)->epoch >= oldest ){
+        link = &(*link)->next;
+    }
+
+    for( reclaim_node_t *node = *link, *next = NULL; node; node = next ){
+        next = node->next;
+        free( node );
+    }
+
+    *link = NULL;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef RECLAIM_H_
+#define RECLAIM_H_
+
+/*
+ * Deferred reclamation for objects published through atomic pointers and
+ * read without locks: once unpublished an object is handed to reclaim_defer
+ * and freed by the drain thread only when no reader can still hold it.
+ *
+ * Readers are the threads running a hook body, each one publishes the epoch
+ * it entered the hook in and clears it on the way out. Objects retired while
+ * the epoch was E are freed once every reader is either outside of a hook or
+ * entered it after E, however long it's been preempted for.
+ */
+
+// minimum time between two reclaim passes.
+#define RECLAIM_PERIOD_MS 250
+
+typedef struct reclaim_node
+{
+    struct reclaim_node *next;
+    // epoch the object was retired in, set by the drain thread.
+    unsigned long        epoch;
+}
+reclaim_node_t;
+
+// per thread, registered from the first hook the thread enters until it exits.
+typedef struct reclaim_reader
+{
+    struct reclaim_reader *next;
+    // epoch the thread entered its current hook in, 0 if outside of hooks.
+    volatile unsigned long epoch;
+}
+reclaim_reader_t;
+
+extern volatile unsigned long __reclaim_epoch;
+
+// node must be the first member of a malloc'ed object.
+void reclaim_defer( reclaim_node_t *node );
+// advance the epoch and free what no reader can hold, called by the drain thread.
+void reclaim_tick();
+void reclaim_register( reclaim_reader_t *reader );
+void reclaim_unregister( reclaim_reader_t *reader );
+// only the forking thread is left in the child.
+void reclaim_atfork_child( reclaim_reader_t *self );
+
+// the epoch must be visible to the drain thread before any published pointer
+// is loaded, hence the full barrier.
+static inline void reclaim_enter( reclaim_reader_t *reader ) {
+    __atomic_store_n( &reader->epoch, __atomic_load_n( &__reclaim_epoch, __ATOMIC_ACQUIRE ), __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+
+static inline void reclaim_leave( reclaim_reader_t *reader ) {
+    __atomic_store_n( &reader->epoch, 0, __ATOMIC_RELEASE );
+}
+
+#endif
@@ -28,100 +28,307 @@
  */
 #include "report.h"
 #include "hook.h"
-#include <sstream>
-#include <iomanip>
+#include "ring.h"
+#include "event.h"
+#include "config.h"
+#include "tracefile.h"
+#include "reclaim.h"
+#include "histogram.h"
+#include "stats.h"
+#include "sample.h"
+#include "tls.h"
+#include "mailbox.h"
 #include <time.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #define LOCK() pthread_mutex_lock(&__lock)
 #define UNLOCK() pthread_mutex_unlock(&__lock)
 
-static report_options_t __opts = { LOGCAT, "", 0 };
+// maximum number of threads that can report at the same time.
+#define REPORT_MAX_RINGS      128
+// microseconds the drain thread sleeps when there's nothing to emit.
+#define REPORT_DRAIN_INTERVAL 1000
+
+typedef struct
+{
+    // tid of the thread owning this ring, 0 if free.
+    volatile pid_t  owner;
+    // set when the owner exits, the ring is released once drained.
+    volatile int    closing;
+    ring_t         *ring;
+}
+ring_slot_t;
+
+static report_options_t __opts HOOK_EARLY_INIT = { LOGCAT, "", 0, 0, 0, 0 };
 static pthread_mutex_t  __lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   __once = PTHREAD_ONCE_INIT;
+static pthread_key_t    __ring_key;
+static ring_slot_t      __rings[REPORT_MAX_RINGS];
+// assigned to threads that must never report, like the drain thread itself.
+static ring_slot_t      __no_ring = { 0, 0, NULL };
+// events dropped because no ring or function id was available.
+static volatile unsigned long __lost = 0;
 
-long int timestamp() {
-    struct timeval tp = {0};
+static uint64_t wallclock() {
+    struct timeval tp = {0, 0};
     gettimeofday(&tp, NULL);
 
-    return tp.tv_sec * 1000 + tp.tv_usec / 1000;
+    return tp.tv_sec * 1000ull + tp.tv_usec / 1000;
 }
 
-static long int __started = timestamp();
+// event timestamps are nanoseconds since this moment, set with the first
+// options ( from libhook_main, before any unit linked after main.cpp is
+// initialized ) so the trace, stats and events all share the same bases.
+static uint64_t __started = 0;
+static uint64_t __wallclock = 0;
 
 void report_set_options( report_options_t *opts ) {
     LOCK();
 
-    __opts.mode = opts->mode;
-    __opts.dest = opts->dest;
-    __opts.port = opts->port;
+    if( __started == 0 ){
+        __started   = hook_clock();
+        __wallclock = wallclock();
+    }
+
+    __opts.dest     = opts->dest;
+    __opts.port     = opts->port;
+    __opts.size     = opts->size;
+    __opts.segments = opts->segments;
+    __opts.interval = opts->interval;
+
+    if( opts->mode == MMAP_FILE && !tracefile_open( opts->dest.c_str(), opts->size, opts->segments, __wallclock ) ){
+        HOOKLOG( "[%d] !!! COULD NOT OPEN TRACE FILE %s, FALLING BACK TO LOGCAT !!!", getpid(), opts->dest.c_str() );
+        __opts.mode = LOGCAT;
+    }
+    else {
+        __opts.mode = opts->mode;
+    }
+
+    stats_init( __opts.mode == STATS, __opts.interval, __started );
 
     UNLOCK();
 }
 
-std::ostringstream& parse( char fmt, std::ostringstream& s, va_list& va ) {
-    switch( fmt )
-    {
-        case 'i':
-            s << va_arg( va, int ) << " ";
-        break;
+static void report_emit( const unsigned char *rec ) {
+    std::string line;
+
+    if( event_format_call( rec, line ) ){
+        HOOKLOG( "%s", line.c_str() );
+    }
+}
+
+unsigned long report_dropped() {
+    unsigned long dropped = __atomic_load_n( &__lost, __ATOMIC_RELAXED ) + tracefile_dropped();
 
-        case 'u':
-            s << va_arg( va, unsigned int ) << " ";
-        break;
+    for( size_t i = 0; i < REPORT_MAX_RINGS; ++i ){
+        ring_t *ring = __atomic_load_n( &__rings[i].ring, __ATOMIC_ACQUIRE );
+        if( ring ){
+            dropped += __atomic_load_n( &ring->dropped, __ATOMIC_RELAXED );
+        }
+    }
 
-        case 'p':
-            s << std::hex << std::setfill('0') << "0x" << va_arg( va, uintptr_t ) << " ";
-        break;
+    return dropped;
+}
 
-        case 's':
-            s << '"' << va_arg( va, const char * ) << '"' << " ";
-        break;
+static void *report_drain( void * ) {
+    unsigned long reported = 0;
 
-        default:
+    hook_tls_t *tls = hook_tls();
 
-            s << std::hex << std::setfill('0') << "0x" << va_arg( va, uintptr_t ) << " ";
+    // whatever we log from here must not end up into a ring again, and any
+    // hook we go through should just call the original function.
+    pthread_setspecific( __ring_key, &__no_ring );
+    if( tls ){
+        tls->depth = 1;
     }
 
-    return s;
+    for(;;){
+        size_t drained = 0;
+
+        for( size_t i = 0; i < REPORT_MAX_RINGS; ++i ){
+            ring_slot_t *slot = &__rings[i];
+            ring_t *ring = __atomic_load_n( &slot->ring, __ATOMIC_ACQUIRE );
+            unsigned char *rec = NULL;
+
+            if( ring == NULL ){
+                continue;
+            }
+
+            for( size_t n = 0; n < RING_SLOTS && ( rec = (unsigned char *)ring_peek( ring ) ); ++n, ++drained ){
+                report_emit( rec );
+                ring_release( ring );
+            }
+
+            // the owner is gone and everything it wrote has been emitted.
+            if( __atomic_load_n( &slot->closing, __ATOMIC_ACQUIRE ) && ring_empty( ring ) ){
+                slot->closing = 0;
+                __atomic_store_n( &slot->owner, 0, __ATOMIC_RELEASE );
+            }
+        }
+
+        tracefile_maintain();
+        reclaim_tick();
+        histogram_tick();
+        stats_tick();
+        sample_tick();
+        libhook_control_tick();
+        mailbox_tick();
+
+        unsigned long dropped = report_dropped();
+        if( dropped != reported ){
+            HOOKLOG( "!!! %lu EVENTS DROPPED SO FAR !!!", dropped );
+            reported = dropped;
+        }
+
+        if( drained == 0 ){
+            usleep( REPORT_DRAIN_INTERVAL );
+        }
+    }
+
+    return NULL;
 }
 
-void report_add( const char *fnname, const char *argsfmt, ... ) {
-	va_list va;
-    size_t i, argc = strlen(argsfmt);
+static void report_start_drain() {
+    pthread_t      thread;
+    pthread_attr_t attr;
 
-    LOCK();
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
 
-    if( __opts.mode == LOGCAT ) {
-        std::ostringstream s;
+    if( pthread_create( &thread, &attr, report_drain, NULL ) != 0 ){
+        HOOKLOG( "[%d] !!! COULD NOT START THE REPORT DRAIN THREAD !!!", getpid() );
+    }
 
-        s << "[ ts=" << ( timestamp() - __started ) << " pid=" << getpid() << ", tid=" << gettid() << " ] " << fnname << "( ";
+    pthread_attr_destroy( &attr );
+}
 
-        va_start( va, argsfmt );
+static void report_thread_exit( void *p ) {
+    ring_slot_t *slot = (ring_slot_t *)p;
 
-        for( i = 0; i < argc; ++i ) {
-            char fmt = argsfmt[i];
+    if( slot != &__no_ring ){
+        __atomic_store_n( &slot->closing, 1, __ATOMIC_RELEASE );
+    }
+}
 
-            // next will be the return value, break
-            if( fmt == '.' ){
-                break;
-            }
+static void report_atfork_child() {
+    // only the forking thread survived and the drain thread is gone, discard
+    // whatever the parent didn't emit yet and start from scratch.
+    for( size_t i = 0; i < REPORT_MAX_RINGS; ++i ){
+        __rings[i].owner   = 0;
+        __rings[i].closing = 0;
+        if( __rings[i].ring ){
+            __rings[i].ring->tail = __rings[i].ring->head;
+        }
+    }
+
+    pthread_setspecific( __ring_key, NULL );
+
+    tracefile_atfork_child();
+
+    report_start_drain();
+}
+
+static void report_setup() {
+    report_options_t opts;
+    std::string mode;
+
+    pthread_key_create( &__ring_key, report_thread_exit );
+    pthread_atfork( NULL, NULL, report_atfork_child );
+
+    mode          = config_get( "report.mode", std::string("logcat") );
+    opts.mode     = mode == "mmap" ? MMAP_FILE : ( mode == "stats" ? STATS : LOGCAT );
+    opts.dest     = config_get( "report.dest", std::string("/data/local/tmp/libhook.trace") );
+    opts.port     = 0;
+    opts.size     = config_get( "report.segment_size", 8ul * 1024 * 1024 );
+    opts.segments = config_get( "report.segments", 4ul );
+    opts.interval = config_get( "stats.interval", 60000ul );
+
+    report_set_options( &opts );
+
+    histogram_init( config_get( "histograms", 0ul ) != 0, config_get( "histograms.interval", 10000ul ) );
+    sample_init();
+
+    report_start_drain();
+}
+
+void report_init() {
+    pthread_once( &__once, report_setup );
+}
+
+void report_prepare() {
+    if( __opts.mode == MMAP_FILE ){
+        tracefile_maintain();
+    }
+}
+
+static ring_slot_t *report_claim_ring() {
+    pid_t tid = hook_gettid();
 
-            s << va_arg( va, char * ) << "=";
-            parse( fmt, s, va );
+    for( size_t i = 0; i < REPORT_MAX_RINGS; ++i ){
+        ring_slot_t *slot = &__rings[i];
+
+        if( slot->owner != 0 || !__sync_bool_compare_and_swap( &slot->owner, 0, tid ) ){
+            continue;
         }
 
-        s << ")";
+        // rings are mapped the first time their slot is claimed and then
+        // recycled forever, so only the very first event of a thread pays this.
+        if( slot->ring == NULL ){
+            void *mem = mmap( NULL, sizeof(ring_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if( mem == MAP_FAILED ){
+                __atomic_store_n( &slot->owner, 0, __ATOMIC_RELEASE );
+                return NULL;
+            }
 
-        // get return value
-        if( i != argc ){
-            char fmt = argsfmt[i + 1];
-            s << " -> ";
-            parse( fmt, s, va );
+            __atomic_store_n( &slot->ring, (ring_t *)mem, __ATOMIC_RELEASE );
         }
 
-        va_end( va );
+        pthread_setspecific( __ring_key, slot );
 
-        HOOKLOG( "%s", s.str().c_str() );
+        return slot;
     }
 
-    UNLOCK();
+    return NULL;
+}
+
+void report_add( const char *fnname, const char *argsfmt, ... ) {
+	va_list va;
+    ring_slot_t *slot = (ring_slot_t *)pthread_getspecific( __ring_key );
+    unsigned char *rec = NULL,
+                   buffer[RING_SLOT_SIZE];
+    int fnid;
+    size_t size = 0;
+
+    // STATS mode accounts calls through HOOK_STATS, no events at all.
+    if( slot == &__no_ring || __opts.mode == STATS ){
+        return;
+    }
+
+    va_start( va, argsfmt );
+
+    // formatting is deferred to the drain thread or to whoever reads the
+    // trace file, here we only encode the raw values as described by argsfmt.
+    if( ( fnid = event_function_id( fnname, argsfmt, va ) ) == EVENT_NO_FUNCTION ){
+        __sync_fetch_and_add( &__lost, 1 );
+    }
+    else if( __opts.mode == MMAP_FILE ){
+        if( ( size = event_encode_call( buffer, sizeof(buffer), fnid, hook_clock() - __started, hook_getpid(), hook_gettid(), va ) ) ){
+            tracefile_append( buffer, size, fnid );
+        }
+    }
+    else if( slot == NULL && ( slot = report_claim_ring() ) == NULL ){
+        __sync_fetch_and_add( &__lost, 1 );
+    }
+    else if( slot->ring != NULL && ( rec = (unsigned char *)ring_reserve( slot->ring ) ) != NULL ){
+        if( event_encode_call( rec, RING_SLOT_SIZE, fnid, hook_clock() - __started, hook_getpid(), hook_gettid(), va ) ){
+            ring_commit( slot->ring );
+        }
+        else {
+            __sync_fetch_and_add( &__lost, 1 );
+        }
+    }
+
+    va_end( va );
 }
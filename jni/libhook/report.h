@@ -35,19 +35,33 @@
 #include <string>
 
 typedef enum {
-    LOGCAT = 0
+    LOGCAT    = 0,
+    // binary records appended to a memory mapped file, see tracefile.h
+    MMAP_FILE = 1,
+    // per descriptor aggregates instead of events, see stats.h
+    STATS     = 2
 }
 report_mode_t;
 
 typedef struct {
     report_mode_t  mode;
-    // for future use
+    // trace file path for MMAP_FILE
     std::string    dest;
+    // for future use
     unsigned short port;
+    // MMAP_FILE segment size in bytes and number of segments before wrapping.
+    size_t         size;
+    unsigned       segments;
+    // STATS milliseconds between two flushes, 0 to only flush on close.
+    unsigned long  interval;
 }
 report_options_t;
 
-void report_set_options( report_options_t *opts );
-void report_add( const char *fnname, const char *argsfmt, ... );
+void          report_init();
+// slow setup of the report backend, done off the constructor.
+void          report_prepare();
+void          report_set_options( report_options_t *opts );
+void          report_add( const char *fnname, const char *argsfmt, ... );
+unsigned long report_dropped();
 
 #endif
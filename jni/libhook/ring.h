@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// must be a power of two.
+#define RING_SLOTS     256
+#define RING_SLOT_SIZE 256
+
+/*
+ * Single producer / single consumer ring of fixed size records, the owning
+ * thread is the only one allowed to reserve and commit slots while the drain
+ * thread is the only one allowed to peek and release them.
+ */
+typedef struct
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    // number of records the producer had to discard because the ring was full.
+    volatile uint32_t dropped;
+    unsigned char     slots[RING_SLOTS][RING_SLOT_SIZE] __attribute__((aligned(8)));
+}
+ring_t;
+
+static inline void *ring_reserve( ring_t *ring ) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+
+    if( head - tail >= RING_SLOTS ){
+        __atomic_store_n( &ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED );
+        return NULL;
+    }
+
+    return ring->slots[ head & ( RING_SLOTS - 1 ) ];
+}
+
+static inline void ring_commit( ring_t *ring ) {
+    __atomic_store_n( &ring->head, ring->head + 1, __ATOMIC_RELEASE );
+}
+
+static inline void *ring_peek( ring_t *ring ) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+
+    if( head == tail ){
+        return NULL;
+    }
+
+    return ring->slots[ tail & ( RING_SLOTS - 1 ) ];
+}
+
+static inline void ring_release( ring_t *ring ) {
+    __atomic_store_n( &ring->tail, ring->tail + 1, __ATOMIC_RELEASE );
+}
+
+static inline bool ring_empty( ring_t *ring ) {
+    return __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE ) == ring->tail;
+}
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "sample.h"
+#include "hook.h"
+#include "config.h"
+#include "reclaim.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// token bucket width, also the maximum burst.
+#define SAMPLE_RATE_PERIOD 1000000000ull
+// minimum nanoseconds between two logs of the suppressed counts.
+#define SAMPLE_LOG_PERIOD  1000000000ull
+
+typedef struct
+{
+    reclaim_node_t    node;
+    volatile uint32_t seen[NHOOKS];
+}
+sample_fd_t;
+
+sample_policy_t __sample_policies[NHOOKS];
+
+// rate limiter state, theoretical arrival time of the next call ( GCRA ).
+static volatile uint64_t      __arrival[NHOOKS];
+static sample_fd_t *volatile  __seen[IO_MAX_FDS];
+static volatile unsigned long __suppressed[NHOOKS];
+static unsigned long          __reported = 0;
+static uint64_t               __logged = 0;
+
+void sample_init() {
+    for( size_t i = 0; i < NHOOKS; ++i ){
+        std::string policy = config_get( ( std::string("sample.") + __hooks[i].name ).c_str(), std::string("all") );
+
+        if( !sample_set( i, policy.c_str() ) ){
+            HOOKLOG( "[%d] !!! INVALID SAMPLING POLICY '%s' FOR %s !!!", getpid(), policy.c_str(), __hooks[i].name );
+        }
+    }
+}
+
+/*
+ * Sampled out calls skip the whole hook body, which is only fine for hooks
+ * that do nothing but reporting. Hooks keeping track of descriptors or
+ * modules must always run, and in STATS mode every call is accounted.
+ */
+static bool sample_supported( unsigned slot ) {
+    switch( slot ){
+        case HOOK_SLOT( open ):
+        case HOOK_SLOT( close ):
+        case HOOK_SLOT( connect ):
+        case HOOK_SLOT( dlopen ):
+        case HOOK_SLOT( android_dlopen_ext ):
+        case HOOK_SLOT( dlclose ):
+            return false;
+
+        default:
+            return !__stats_enabled;
+    }
+}
+
+bool sample_set( unsigned slot, const char *policy ) {
+    sample_mode_t mode = SAMPLE_ALL;
+    unsigned n = 0;
+
+    if( slot >= NHOOKS ){
+        return false;
+    }
+    else if( strcmp( policy, "all" ) != 0 && !sample_supported( slot ) ){
+        return false;
+    }
+    else if( sscanf( policy, "every %u", &n ) == 1 && n > 0 ){
+        mode = SAMPLE_ONE_IN_N;
+    }
+    else if( sscanf( policy, "rate %u", &n ) == 1 && n > 0 ){
+        mode = SAMPLE_RATE;
+    }
+    else if( sscanf( policy, "first %u", &n ) == 1 ){
+        mode = SAMPLE_FIRST_N;
+    }
+    else if( strcmp( policy, "all" ) != 0 ){
+        return false;
+    }
+
+    __atomic_store_n( &__sample_policies[slot].n, n, __ATOMIC_RELAXED );
+    __atomic_store_n( &__sample_policies[slot].mode, mode, __ATOMIC_RELEASE );
+
+    return true;
+}
+
+static void sample_suppress( unsigned slot, unsigned long count ) {
+    __sync_fetch_and_add( &__suppressed[slot], count );
+}
+
+static bool sample_rate( unsigned slot, uint32_t rate ) {
+    uint64_t now = hook_clock(),
+             period = SAMPLE_RATE_PERIOD / rate,
+             arrival = 0,
+             next = 0;
+
+    do {
+        arrival = __atomic_load_n( &__arrival[slot], __ATOMIC_RELAXED );
+        next    = arrival > now ? arrival : now;
+        // the bucket is empty.
+        if( next - now >= SAMPLE_RATE_PERIOD ){
+            return false;
+        }
+    }
+    while( !__sync_bool_compare_and_swap( &__arrival[slot], arrival, next + period ) );
+
+    return true;
+}
+
+static bool sample_first( unsigned slot, int fd, uint32_t n ) {
+    sample_fd_t *entry = NULL;
+
+    // no descriptor, like for open.
+    if( fd < 0 || fd >= IO_MAX_FDS ){
+        return true;
+    }
+
+    if( ( entry = __atomic_load_n( &__seen[fd], __ATOMIC_ACQUIRE ) ) == NULL ){
+        if( ( entry = (sample_fd_t *)calloc( 1, sizeof(sample_fd_t) ) ) == NULL ){
+            return true;
+        }
+        else if( !__sync_bool_compare_and_swap( &__seen[fd], (sample_fd_t *)NULL, entry ) ){
+            free( entry );
+            entry = __atomic_load_n( &__seen[fd], __ATOMIC_ACQUIRE );
+        }
+    }
+
+    return entry->seen[slot] < n && __sync_fetch_and_add( &entry->seen[slot], 1 ) < n;
+}
+
+bool sample_admit( unsigned slot, int fd ) {
+    hook_tls_t *tls = hook_tls();
+    sample_mode_t mode = __atomic_load_n( &__sample_policies[slot].mode, __ATOMIC_ACQUIRE );
+    uint32_t n = __atomic_load_n( &__sample_policies[slot].n, __ATOMIC_RELAXED );
+    bool admit = true;
+
+    // every call of the last countdown was sampled out.
+    if( tls->window[slot] ){
+        sample_suppress( slot, tls->window[slot] );
+        tls->window[slot] = 0;
+    }
+
+    switch( mode ){
+        case SAMPLE_ONE_IN_N:
+            tls->countdown[slot] = tls->window[slot] = n - 1;
+        break;
+
+        case SAMPLE_RATE:
+            if( !( admit = sample_rate( slot, n ) ) ){
+                tls->countdown[slot] = tls->window[slot] = SAMPLE_BACKOFF;
+            }
+        break;
+
+        case SAMPLE_FIRST_N:
+            admit = sample_first( slot, fd, n );
+        break;
+
+        default:
+        break;
+    }
+
+    if( !admit ){
+        sample_suppress( slot, 1 );
+    }
+
+    return admit;
+}
+
+void sample_close( int fd ) {
+    sample_fd_t *entry = NULL;
+
+    if( fd >= 0 && fd < IO_MAX_FDS && __atomic_load_n( &__seen[fd], __ATOMIC_RELAXED ) ){
+        if( ( entry = __atomic_exchange_n( &__seen[fd], (sample_fd_t *)NULL, __ATOMIC_ACQ_REL ) ) ){
+            reclaim_defer( &entry->node );
+        }
+    }
+}
+
+void sample_release( const uint32_t *countdown, const uint32_t *window ) {
+    for( size_t i = 0; i < NHOOKS; ++i ){
+        if( window[i] > countdown[i] ){
+            sample_suppress( i, window[i] - countdown[i] );
+        }
+    }
+}
+
+void sample_tick() {
+    unsigned long total = 0;
+    uint64_t now = hook_clock();
+    std::string line;
+    char buffer[0xFF] = {0};
+
+    if( now - __logged < SAMPLE_LOG_PERIOD ){
+        return;
+    }
+
+    for( size_t i = 0; i < NHOOKS; ++i ){
+        unsigned long suppressed = sample_suppressed( i );
+
+        if( suppressed ){
+            snprintf( buffer, sizeof(buffer), " %s=%lu", __hooks[i].name, suppressed );
+            line  += buffer;
+            total += suppressed;
+        }
+    }
+
+    if( total != __reported ){
+        HOOKLOG( "Calls suppressed by sampling:%s", line.c_str() );
+        __reported = total;
+        __logged   = now;
+    }
+}
+
+unsigned long sample_suppressed( unsigned slot ) {
+    return __atomic_load_n( &__suppressed[slot], __ATOMIC_RELAXED );
+}
+
+// exported so policies can be changed at runtime, e.g. through the injector.
+extern "C" __attribute__ ((visibility ("default"))) int libhook_set_sampling( const char *hook, const char *policy ) {
+    for( size_t i = 0; i < NHOOKS; ++i ){
+        if( strcmp( __hooks[i].name, hook ) == 0 ){
+            return sample_set( i, policy ) ? 0 : -1;
+        }
+    }
+
+    return -1;
+}
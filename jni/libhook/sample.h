@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SAMPLE_H_
+#define SAMPLE_H_
+
+#include <stdint.h>
+#include "hooks/hooks.h"
+
+/*
+ * Per hook sampling policies, calls which are sampled out go straight to the
+ * original function and are only counted, so totals are still reported.
+ */
+typedef enum {
+    // every call is traced.
+    SAMPLE_ALL      = 0,
+    // one call every n.
+    SAMPLE_ONE_IN_N = 1,
+    // at most n calls per second, with bursts of up to n calls.
+    SAMPLE_RATE     = 2,
+    // the first n calls on every descriptor.
+    SAMPLE_FIRST_N  = 3
+}
+sample_mode_t;
+
+typedef struct
+{
+    volatile sample_mode_t mode;
+    volatile uint32_t      n;
+}
+sample_policy_t;
+
+// calls a thread skips without checking when the rate limit is exceeded.
+#define SAMPLE_BACKOFF 16
+
+extern sample_policy_t __sample_policies[NHOOKS];
+
+// read sample.<hook> policies from the configuration.
+void          sample_init();
+// parse and apply a policy: "all", "every N", "rate N" or "first N", only
+// "all" is accepted for open, close, connect and the dl hooks, or in STATS mode.
+bool          sample_set( unsigned slot, const char *policy );
+// slow path of hook_guard_t::sampled_out, sets the thread countdown.
+bool          sample_admit( unsigned slot, int fd );
+// reset the first n counters of a descriptor being closed.
+void          sample_close( int fd );
+// account what's left in the countdowns of an exiting thread.
+void          sample_release( const uint32_t *countdown, const uint32_t *window );
+// log suppressed counts when they change, called by the drain thread.
+void          sample_tick();
+unsigned long sample_suppressed( unsigned slot );
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "stats.h"
+#include "hook.h"
+#include "reclaim.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+    volatile uint32_t calls;
+    volatile uint32_t errors;
+    volatile uint64_t bytes;
+    // nanoseconds timestamps of the first and last call, 0 if none.
+    volatile uint64_t first;
+    volatile uint64_t last;
+}
+stats_counter_t;
+
+/*
+ * Allocated on the first call on a descriptor and published into the table
+ * the same way the descriptor names are, closing swaps it out and hands it
+ * to the reclaimer so concurrent callers never touch freed memory.
+ */
+typedef struct
+{
+    reclaim_node_t  node;
+    stats_counter_t hooks[NHOOKS];
+}
+fd_stats_t;
+
+volatile bool __stats_enabled = false;
+
+static fd_stats_t *volatile   __stats[IO_MAX_FDS];
+static unsigned long          __interval = 0;
+static uint64_t               __started = 0;
+static uint64_t               __last = 0;
+// calls which failed without a descriptor to account them on, like an open
+// returning -1, still count as errors of their hook.
+static stats_counter_t        __failed[NHOOKS];
+// calls not accounted because the descriptor is out of range or no memory.
+static volatile unsigned long __dropped = 0;
+
+void stats_init( bool enabled, unsigned long interval, uint64_t started ) {
+    __interval = interval;
+    __started  = started;
+    __last     = hook_clock();
+
+    __atomic_store_n( &__stats_enabled, enabled, __ATOMIC_RELEASE );
+}
+
+static fd_stats_t *stats_get( int fd ) {
+    fd_stats_t *entry = __atomic_load_n( &__stats[fd], __ATOMIC_ACQUIRE );
+
+    if( entry == NULL ){
+        if( ( entry = (fd_stats_t *)calloc( 1, sizeof(fd_stats_t) ) ) == NULL ){
+            return NULL;
+        }
+        // another thread got here first.
+        else if( !__sync_bool_compare_and_swap( &__stats[fd], (fd_stats_t *)NULL, entry ) ){
+            free( entry );
+            entry = __atomic_load_n( &__stats[fd], __ATOMIC_ACQUIRE );
+        }
+    }
+
+    return entry;
+}
+
+void stats_add( unsigned slot, int fd, ssize_t ret, bool bytes ) {
+    fd_stats_t *entry = NULL;
+    stats_counter_t *c = NULL;
+    uint64_t now = hook_clock();
+
+    if( fd >= 0 && fd < IO_MAX_FDS && ( entry = stats_get( fd ) ) != NULL ){
+        c = &entry->hooks[slot];
+    }
+    else if( ret < 0 ){
+        c = &__failed[slot];
+    }
+    else {
+        __sync_fetch_and_add( &__dropped, 1 );
+        return;
+    }
+
+    __sync_fetch_and_add( &c->calls, 1 );
+    if( ret < 0 ){
+        __sync_fetch_and_add( &c->errors, 1 );
+    }
+    else if( bytes && ret > 0 ){
+        __sync_fetch_and_add( &c->bytes, (uint64_t)ret );
+    }
+
+    if( c->first == 0 ){
+        __sync_bool_compare_and_swap( &c->first, 0, now );
+    }
+    __atomic_store_n( &c->last, now, __ATOMIC_RELAXED );
+}
+
+static void stats_flush( int fd, const char *name, const stats_counter_t *hooks ) {
+    std::string line;
+    char buffer[0xFF] = {0};
+
+    for( size_t i = 0; i < NHOOKS; ++i ){
+        const stats_counter_t *c = &hooks[i];
+        uint32_t calls = __atomic_load_n( &c->calls, __ATOMIC_RELAXED );
+
+        if( calls == 0 ){
+            continue;
+        }
+
+        uint64_t first = __atomic_load_n( &c->first, __ATOMIC_RELAXED ),
+                 last  = __atomic_load_n( &c->last, __ATOMIC_RELAXED );
+
+        snprintf( buffer, sizeof(buffer), " %s( n=%u err=%u bytes=%llu first=%llu last=%llu )",
+                  __hooks[i].name,
+                  calls,
+                  __atomic_load_n( &c->errors, __ATOMIC_RELAXED ),
+                  (unsigned long long)__atomic_load_n( &c->bytes, __ATOMIC_RELAXED ),
+                  (unsigned long long)( first > __started ? ( first - __started ) / 1000000 : 0 ),
+                  (unsigned long long)( last > __started ? ( last - __started ) / 1000000 : 0 ) );
+
+        line += buffer;
+    }
+
+    if( !line.empty() ){
+        HOOKLOG( "[ pid=%d ] fd=%d %s:%s", hook_getpid(), fd, name, line.c_str() );
+    }
+}
+
+void stats_close( int fd, const char *name ) {
+    fd_stats_t *entry = NULL;
+
+    if( fd < 0 || fd >= IO_MAX_FDS ){
+        return;
+    }
+
+    if( ( entry = __atomic_exchange_n( &__stats[fd], (fd_stats_t *)NULL, __ATOMIC_ACQ_REL ) ) ){
+        stats_flush( fd, name, entry->hooks );
+        reclaim_defer( &entry->node );
+    }
+}
+
+void stats_dump() {
+    HOOKLOG( "[ pid=%d ] Descriptor stats ( timestamps in ms, %lu calls not accounted ):", hook_getpid(), stats_dropped() );
+
+    for( int fd = 0; fd < IO_MAX_FDS; ++fd ){
+        fd_stats_t *entry = __atomic_load_n( &__stats[fd], __ATOMIC_ACQUIRE );
+        if( entry ){
+            stats_flush( fd, io_resolve_descriptor(fd), entry->hooks );
+        }
+    }
+
+    stats_flush( -1, "<failed>", __failed );
+}
+
+void stats_tick() {
+    uint64_t now = hook_clock();
+
+    if( __interval && __stats_enabled && now - __last >= __interval * 1000000ull ){
+        __last = now;
+        stats_dump();
+    }
+}
+
+unsigned long stats_dropped() {
+    return __atomic_load_n( &__dropped, __ATOMIC_RELAXED );
+}
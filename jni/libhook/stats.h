@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Aggregated per descriptor and per hook counters for the STATS report mode,
+ * memory usage grows with the number of open descriptors instead of with
+ * the number of calls, and output is a summary line per descriptor when it
+ * gets closed or every flush interval.
+ */
+
+// whether hooks should account their calls at all.
+extern volatile bool __stats_enabled;
+
+void          stats_init( bool enabled, unsigned long interval, uint64_t started );
+// account a call of the given hook, bytes tells if a positive return value
+// is the number of bytes moved.
+void          stats_add( unsigned slot, int fd, ssize_t ret, bool bytes );
+// flush and forget the counters of a descriptor being closed.
+void          stats_close( int fd, const char *name );
+// flush every interval milliseconds, called by the drain thread.
+void          stats_tick();
+// flush the counters of every open descriptor.
+void          stats_dump();
+unsigned long stats_dropped();
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "tls.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static pthread_once_t __once = PTHREAD_ONCE_INIT;
+static pthread_key_t  __key;
+static volatile pid_t __pid = 0;
+
+static void hook_tls_atfork_child() {
+    hook_tls_t *tls = (hook_tls_t *)pthread_getspecific( __key );
+
+    // the forking thread is the only one left and it has new ids.
+    __pid = 0;
+    if( tls ){
+        tls->tid = 0;
+    }
+
+    reclaim_atfork_child( tls ? &tls->reader : NULL );
+}
+
+static void hook_tls_destroy( void *p ) {
+    hook_tls_t *tls = (hook_tls_t *)p;
+
+    if( tls->histograms ){
+        histogram_release( tls->histograms );
+    }
+
+    sample_release( tls->countdown, tls->window );
+    reclaim_unregister( &tls->reader );
+
+    free( tls );
+}
+
+static void hook_tls_setup() {
+    pthread_key_create( &__key, hook_tls_destroy );
+    pthread_atfork( NULL, NULL, hook_tls_atfork_child );
+}
+
+hook_tls_t *hook_tls() {
+    hook_tls_t *tls = NULL;
+
+    pthread_once( &__once, hook_tls_setup );
+
+    if( ( tls = (hook_tls_t *)pthread_getspecific( __key ) ) == NULL ){
+        if( ( tls = (hook_tls_t *)calloc( 1, sizeof(hook_tls_t) ) ) != NULL ){
+            reclaim_register( &tls->reader );
+            pthread_setspecific( __key, tls );
+        }
+    }
+
+    return tls;
+}
+
+pid_t hook_getpid() {
+    pid_t pid = __pid;
+
+    if( pid == 0 ){
+        __pid = pid = getpid();
+    }
+
+    return pid;
+}
+
+pid_t hook_gettid() {
+    hook_tls_t *tls = hook_tls();
+
+    if( tls == NULL ){
+        return gettid();
+    }
+    else if( tls->tid == 0 ){
+        tls->tid = gettid();
+    }
+
+    return tls->tid;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TLS_H_
+#define TLS_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include "histogram.h"
+#include "sample.h"
+#include "reclaim.h"
+
+/*
+ * Per thread hooks state, allocated the first time a thread enters a hook
+ * and released when it exits.
+ */
+typedef struct
+{
+    // how many hooks this thread is currently inside of.
+    int   depth;
+    // cached thread id, reset in the child after a fork.
+    pid_t tid;
+    // latency histograms of this thread, claimed on the first sample.
+    hist_table_t *histograms;
+    // calls of each hook to sample out before checking the policy again,
+    // and the value the countdown was last loaded with.
+    uint32_t      countdown[NHOOKS];
+    uint32_t      window[NHOOKS];
+    // keeps what this thread's hook reads from being reclaimed under it.
+    reclaim_reader_t reader;
+}
+hook_tls_t;
+
+// NULL only if the state could not be allocated.
+hook_tls_t *hook_tls();
+// getpid and gettid without entering the kernel but the first time.
+pid_t       hook_getpid();
+pid_t       hook_gettid();
+
+// monotonic nanoseconds for event timestamps and latencies, CLOCK_MONOTONIC
+// is served by the vDSO ( reading the ARM generic timer ), so this doesn't
+// enter the kernel.
+static inline uint64_t hook_clock() {
+    struct timespec ts = {0, 0};
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Scoped guard marking the current thread as inside a hook, anything the
+ * hook itself or the reporting code does that ends up in another hook will
+ * see reentered() and must go straight to the original function.
+ */
+class hook_guard_t
+{
+private:
+
+    hook_tls_t *_tls;
+    // start of the timed original call, 0 if latencies are not measured.
+    uint64_t    _started;
+    uint64_t    _elapsed;
+    // set once the call is admitted and its reclaim epoch entered.
+    bool        _reading;
+
+public:
+
+    hook_guard_t() : _tls( hook_tls() ), _started( 0 ), _elapsed( 0 ), _reading( false ) {
+        if( _tls ){
+            ++_tls->depth;
+        }
+    }
+
+    // threads without a state are never traced, to be on the safe side.
+    bool reentered() const {
+        return _tls == NULL || _tls->depth > 1;
+    }
+
+    // only valid if not reentered(), sampled out calls must go straight to the
+    // original function without being reported. Calls skipped by the countdown
+    // never touch a published object, only the ones going on to the policy
+    // and the hook body enter the reclaim epoch and pay for its barrier.
+    bool sampled_out( unsigned slot, int fd ) {
+        if( _tls->countdown[slot] ){
+            --_tls->countdown[slot];
+            return true;
+        }
+
+        reclaim_enter( &_tls->reader );
+        _reading = true;
+
+        return __sample_policies[slot].mode != SAMPLE_ALL && !sample_admit( slot, fd );
+    }
+
+    // the first argument of descriptor based hooks is the descriptor itself.
+    template<typename T> bool sampled_out( unsigned slot, T ) {
+        return sampled_out( slot, -1 );
+    }
+
+    // begin() and end() wrap the original call, see ORIGINAL_TIMED.
+    void begin() {
+        if( __histograms_enabled ){
+            _started = hook_clock();
+        }
+    }
+
+    template<typename T> T end( T ret ) {
+        if( _started ){
+            _elapsed = hook_clock() - _started;
+        }
+        return ret;
+    }
+
+    bool timed() const {
+        return _started != 0;
+    }
+
+    uint64_t elapsed() const {
+        return _elapsed;
+    }
+
+    ~hook_guard_t() {
+        if( _reading ){
+            reclaim_leave( &_tls->reader );
+        }
+        if( _tls ){
+            --_tls->depth;
+        }
+    }
+};
+
+#endif
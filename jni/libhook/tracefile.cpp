@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "tracefile.h"
+#include "event.h"
+#include "hook.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+typedef struct
+{
+    unsigned char    *base;
+    size_t            size;
+    // offset of the next record, may go past 'size' once the segment is full.
+    volatile size_t   used;
+    // bitmap of the functions already described inside this segment.
+    volatile uint32_t described[ ( EVENT_MAX_FUNCTIONS + 31 ) / 32 ];
+    unsigned          index;
+    // writers currently copying into this segment, it's only unmapped once
+    // it's no longer current and this drops to zero.
+    volatile int      writers;
+}
+segment_t;
+
+// current, next and retired, plus one spare. Segment structures are never
+// freed so a writer can always take a reference on the one it loaded, even
+// if it's been retired meanwhile.
+#define TRACEFILE_POOL 4
+// milliseconds to wait after a segment could not be created before trying
+// again, a full disk must not cost an open and a log line every drain tick.
+#define TRACEFILE_RETRY_MS 1000
+
+static std::string         __path HOOK_EARLY_INIT;
+// report.dest, forked children write to <dest>.<pid>.<n> instead.
+static std::string         __dest HOOK_EARLY_INIT;
+static size_t              __size     = 0;
+static unsigned            __segments = 0;
+static uint64_t            __started  = 0;
+static segment_t *volatile __current  = NULL;
+static segment_t *volatile __next     = NULL;
+// segment we rolled away from, it's unmapped once its last writer is done.
+static segment_t *volatile __retired  = NULL;
+static segment_t          *__graveyard = NULL;
+static segment_t           __pool[TRACEFILE_POOL];
+static bool                __opened = false;
+// when segment_create last failed, 0 if it didn't.
+static uint64_t            __failed_at = 0;
+// tracefile_maintain runs on the drain thread, and once on the installer.
+static pthread_mutex_t     __maintain_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile unsigned long __dropped = 0;
+
+static segment_t *segment_create( unsigned index ) {
+    char filename[0xFF] = {0};
+    unsigned char zeroes[0x1000] = {0};
+    segment_t *seg = NULL;
+    void *base = MAP_FAILED;
+    int fd = -1;
+
+    snprintf( filename, sizeof(filename), "%s.%u", __path.c_str(), index % __segments );
+
+    fd = open( filename, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( fd == -1 ){
+        HOOKLOG( "Could not create trace segment %s.", filename );
+        return NULL;
+    }
+
+    // actually allocate the blocks now, writing to a sparse mapping on a full
+    // disk would SIGBUS the target.
+    for( size_t off = 0; off < __size; off += sizeof(zeroes) ){
+        if( pwrite( fd, zeroes, sizeof(zeroes), off ) != sizeof(zeroes) ){
+            HOOKLOG( "Could not preallocate trace segment %s.", filename );
+            goto done;
+        }
+    }
+
+    base = mmap( NULL, __size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( base == MAP_FAILED ){
+        HOOKLOG( "Could not map trace segment %s.", filename );
+        goto done;
+    }
+
+    // only the maintenance code creates and destroys segments.
+    for( size_t i = 0; i < TRACEFILE_POOL && seg == NULL; ++i ){
+        if( __pool[i].base == NULL ){
+            seg = &__pool[i];
+        }
+    }
+
+    if( seg == NULL ){
+        munmap( base, __size );
+        goto done;
+    }
+
+    // writers is left alone, a late writer may still be backing off.
+    memset( (void *)seg->described, 0, sizeof(seg->described) );
+
+    seg->base  = (unsigned char *)base;
+    seg->size  = __size;
+    seg->index = index;
+    seg->used  = event_encode_stream( seg->base, seg->size, __started );
+
+    done:
+
+    close(fd);
+
+    return seg;
+}
+
+static void segment_destroy( segment_t *seg ) {
+    munmap( seg->base, seg->size );
+    __atomic_store_n( &seg->base, (unsigned char *)NULL, __ATOMIC_RELEASE );
+}
+
+/*
+ * Take a reference on the current segment, the writers count is bumped
+ * before checking that the segment is still current, so the maintenance code
+ * either sees the writer or the writer sees the segment has been retired.
+ */
+static segment_t *segment_hold() {
+    for(;;){
+        segment_t *seg = __atomic_load_n( &__current, __ATOMIC_ACQUIRE );
+        if( seg == NULL ){
+            return NULL;
+        }
+
+        __sync_fetch_and_add( &seg->writers, 1 );
+
+        if( __atomic_load_n( &__current, __ATOMIC_SEQ_CST ) == seg ){
+            return seg;
+        }
+
+        __sync_fetch_and_sub( &seg->writers, 1 );
+    }
+}
+
+static void segment_release( segment_t *seg ) {
+    __sync_fetch_and_sub( &seg->writers, 1 );
+}
+
+bool tracefile_open( const char *path, size_t size, unsigned segments, uint64_t started ) {
+    char filename[0xFF] = {0};
+
+    if( __opened ){
+        return false;
+    }
+
+    __path     = path;
+    __dest     = path;
+    // segments are made of whole pages.
+    __size     = ( size + 0xFFF ) & ~0xFFF;
+    // the next segment is always created while the current one is in use.
+    __segments = segments < 2 ? 2 : segments;
+    __started  = started;
+
+    // this runs in the constructor while the injector holds the target, so
+    // only check the first segment can be created, preallocating and mapping
+    // it is up to tracefile_maintain.
+    snprintf( filename, sizeof(filename), "%s.0", __path.c_str() );
+
+    int fd = open( filename, O_RDWR | O_CREAT, 0644 );
+    if( fd == -1 ){
+        return false;
+    }
+
+    close(fd);
+
+    __opened = true;
+
+    return true;
+}
+
+static bool segment_append( segment_t *seg, const unsigned char *rec, size_t size ) {
+    // records are kept word aligned so their header can be published with a
+    // single atomic store, the padding is accounted in the header size.
+    size_t padded = ( size + 3 ) & ~3,
+           off    = __sync_fetch_and_add( &seg->used, padded );
+    event_header_t hdr;
+    uint32_t word;
+
+    if( off + padded > seg->size ){
+        return false;
+    }
+
+    memcpy( seg->base + off + sizeof(hdr), rec + sizeof(hdr), size - sizeof(hdr) );
+
+    // the header goes last, so an interrupted record reads as the end of the
+    // segment.
+    memcpy( &hdr, rec, sizeof(hdr) );
+    hdr.size = padded;
+    memcpy( &word, &hdr, sizeof(word) );
+
+    __atomic_store_n( (uint32_t *)( seg->base + off ), word, __ATOMIC_RELEASE );
+
+    return true;
+}
+
+static bool segment_describe( segment_t *seg, unsigned fnid ) {
+    uint32_t bit = 1u << ( fnid % 32 );
+    unsigned char rec[0x200];
+    size_t size;
+
+    if( __atomic_load_n( &seg->described[fnid / 32], __ATOMIC_RELAXED ) & bit ){
+        return true;
+    }
+    // somebody else is doing it.
+    else if( __sync_fetch_and_or( &seg->described[fnid / 32], bit ) & bit ){
+        return true;
+    }
+
+    return ( size = event_encode_function( rec, sizeof(rec), fnid ) ) != 0 && segment_append( seg, rec, size );
+}
+
+bool tracefile_append( const unsigned char *rec, size_t size, unsigned fnid ) {
+    for(;;){
+        segment_t *seg = segment_hold();
+        if( seg == NULL ){
+            break;
+        }
+
+        if( segment_describe( seg, fnid ) && segment_append( seg, rec, size ) ){
+            segment_release( seg );
+            return true;
+        }
+
+        segment_release( seg );
+
+        // the segment is full, swap in the next one if it's ready.
+        segment_t *next = __atomic_load_n( &__next, __ATOMIC_ACQUIRE );
+        if( next == NULL ){
+            break;
+        }
+
+        if( __sync_bool_compare_and_swap( &__current, seg, next ) ){
+            __atomic_store_n( &__next, (segment_t *)NULL, __ATOMIC_RELEASE );
+            __atomic_store_n( &__retired, seg, __ATOMIC_RELEASE );
+        }
+    }
+
+    __sync_fetch_and_add( &__dropped, 1 );
+
+    return false;
+}
+
+// segment_create, unless it failed less than TRACEFILE_RETRY_MS ago.
+static segment_t *segment_retry( unsigned index ) {
+    uint64_t now = hook_clock();
+    segment_t *seg = NULL;
+
+    if( __failed_at && now - __failed_at < TRACEFILE_RETRY_MS * 1000000ull ){
+        return NULL;
+    }
+
+    seg = segment_create( index );
+    __failed_at = seg ? 0 : now;
+
+    return seg;
+}
+
+void tracefile_maintain() {
+    if( !__opened ){
+        return;
+    }
+
+    pthread_mutex_lock( &__maintain_lock );
+
+    segment_t *seg = __atomic_load_n( &__current, __ATOMIC_ACQUIRE );
+
+    // the very first segment, events reported before it's ready are dropped.
+    if( seg == NULL && __graveyard == NULL ){
+        __atomic_store_n( &__current, segment_retry( 0 ), __ATOMIC_RELEASE );
+    }
+
+    if( __graveyard == NULL ){
+        __graveyard = __atomic_exchange_n( &__retired, (segment_t *)NULL, __ATOMIC_ACQ_REL );
+    }
+
+    // it's no longer current, so no new writer can show up.
+    if( __graveyard && __atomic_load_n( &__graveyard->writers, __ATOMIC_SEQ_CST ) == 0 ){
+        segment_destroy( __graveyard );
+        __graveyard = NULL;
+    }
+
+    // prepare the next segment once the current one is half full, unless the
+    // old one is still mapped since they might share the same file.
+    if( seg && __graveyard == NULL && __atomic_load_n( &__next, __ATOMIC_ACQUIRE ) == NULL && seg->used > seg->size / 2 ){
+        __atomic_store_n( &__next, segment_retry( seg->index + 1 ), __ATOMIC_RELEASE );
+    }
+
+    pthread_mutex_unlock( &__maintain_lock );
+}
+
+void tracefile_atfork_child() {
+    char suffix[32] = {0};
+
+    if( !__opened ){
+        return;
+    }
+
+    // the segments are still shared with the parent, which keeps writing at
+    // its own offsets, so the child starts its own files from scratch. It's
+    // the only thread left, nobody can be writing.
+    for( size_t i = 0; i < TRACEFILE_POOL; ++i ){
+        if( __pool[i].base ){
+            munmap( __pool[i].base, __pool[i].size );
+        }
+
+        __pool[i].base    = NULL;
+        __pool[i].writers = 0;
+    }
+
+    __current   = NULL;
+    __next      = NULL;
+    __retired   = NULL;
+    __graveyard = NULL;
+    __failed_at = 0;
+
+    pthread_mutex_init( &__maintain_lock, NULL );
+
+    snprintf( suffix, sizeof(suffix), ".%d", getpid() );
+    __path = __dest + suffix;
+}
+
+unsigned long tracefile_dropped() {
+    return __atomic_load_n( &__dropped, __ATOMIC_RELAXED );
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2015, Simone Margaritelli <evilsocket at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of ARM Inject nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TRACEFILE_H_
+#define TRACEFILE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Memory mapped trace file made of fixed size segments named <path>.<n>,
+ * each one starting with an EVENT_STREAM record and describing every
+ * function it references, so that any segment can be decoded on its own.
+ *
+ * Writers only bump the write offset of the current segment and copy their
+ * record, the next segment is prepared in advance by tracefile_maintain()
+ * ( called periodically by the drain thread ) so that rolling over is a
+ * single pointer swap. Once 'segments' segments have been written, the
+ * oldest one is overwritten. tracefile_open() only checks the path, the
+ * first segment is created by tracefile_maintain() as well.
+ */
+bool          tracefile_open( const char *path, size_t size, unsigned segments, uint64_t started );
+bool          tracefile_append( const unsigned char *rec, size_t size, unsigned fnid );
+void          tracefile_maintain();
+// drop the segments shared with the parent, the child writes to
+// <path>.<pid>.<n> once tracefile_maintain() runs again.
+void          tracefile_atfork_child();
+unsigned long tracefile_dropped();
+
+#endif